@@ -1,9 +1,24 @@
 #include "AnsiTerminal.h"
 #include <iostream>
-#include <unistd.h>   // For read()
+#include <unistd.h>   // For read() and write()
+#include <cerrno>
+#include <poll.h>     // For poll()
 #include <termios.h>  // For terminal control
+#include <sys/ioctl.h> // For TIOCGWINSZ
+#include <csignal>    // For SIGWINCH
+
+namespace {
+    volatile std::sig_atomic_t resized = 0;
+
+    void onResize(int) {
+        resized = 1;
+    }
+}
+
+AnsiTerminal::AnsiTerminal(int outputFd, bool captureInput) : outputFd(outputFd), captureInput(captureInput) {
+    if (!captureInput)
+        return;
 
-AnsiTerminal::AnsiTerminal() {
     // Save the original terminal settings
     tcgetattr(STDIN_FILENO, &original_tio);
     struct termios new_tio = original_tio;
@@ -11,12 +26,38 @@ AnsiTerminal::AnsiTerminal() {
     // Disable canonical mode and echo for real-time input reading
     new_tio.c_lflag &= ~(ICANON | ECHO);
     tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
+
+    // Track window resizes; no SA_RESTART, so a resize wakes up a blocked read()
+    struct sigaction action = {};
+    action.sa_handler = onResize;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGWINCH, &action, &original_winch);
+    updateSize();
 }
 
 AnsiTerminal::~AnsiTerminal() {
+    if (!captureInput)
+        return;
+    sigaction(SIGWINCH, &original_winch, nullptr);
     tcsetattr(STDIN_FILENO, TCSANOW, &original_tio);
 }
 
+void AnsiTerminal::updateSize() {
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0) {
+        rows = size.ws_row;
+        cols = size.ws_col;
+    }
+}
+
+bool AnsiTerminal::checkResize() {
+    if (!resized)
+        return false;
+    resized = 0;
+    updateSize();
+    return true;
+}
+
 void AnsiTerminal::printAt(int row, int col, const std::string &text) {
     std::cout << "\033[" << row << ";" << col << "H" << text << std::flush;
 }
@@ -29,35 +70,143 @@ void AnsiTerminal::clearScreen() {
     std::cout << "\033[2J\033[H" << std::flush;
 }
 
+void AnsiTerminal::beginFrame() {
+    frame.clear();
+    if (synchronizedOutput)
+        frame += "\033[?2026h";
+    emptyFrameSize = frame.size();
+}
+
+void AnsiTerminal::queuePosition(int row, int col) {
+    frame += "\033[";
+    frame += std::to_string(row);
+    frame += ';';
+    frame += std::to_string(col);
+    frame += 'H';
+}
+
+void AnsiTerminal::queueAt(int row, int col, const std::string &text) {
+    queuePosition(row, col);
+    frame += text;
+}
+
+void AnsiTerminal::queueInvertedAt(int row, int col, const std::string &text) {
+    queuePosition(row, col);
+    frame += "\033[7m";
+    frame += text;
+    frame += "\033[0m";
+}
+
+void AnsiTerminal::queueClearScreen() {
+    frame += "\033[2J\033[H";
+}
+
+void AnsiTerminal::endFrame() {
+    if (frame.size() == emptyFrameSize) {
+        frame.clear();  // Nothing changed: no write at all
+        return;
+    }
+    if (synchronizedOutput)
+        frame += "\033[?2026l";
+
+    std::cout.flush();  // Anything printed before the frame must appear before it
+    const char *data = frame.data();
+    size_t remaining = frame.size();
+    while (remaining > 0) {
+        ssize_t written = write(outputFd, data, remaining);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            break;  // The terminal is gone; nothing sensible left to do with the frame
+        data += written;
+        remaining -= written;
+    }
+    frame.clear();
+}
+
+bool AnsiTerminal::readInput(int timeoutMs) {
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&input, 1, timeoutMs) <= 0)
+        return false;  // Timed out or interrupted, e.g. by a window resize
+
+    // Take everything that is available, so held keys arrive together
+    char buffer[256];
+    ssize_t count = read(STDIN_FILENO, buffer, sizeof(buffer));
+    if (count <= 0)
+        return false;
+    inputBuffer.append(buffer, count);
+    return true;
+}
+
+void AnsiTerminal::decodeInput(bool complete) {
+    size_t pos = 0;
+    while (pos < inputBuffer.size()) {
+        char ch = inputBuffer[pos];
+        if (ch != '\033') {
+            keyQueue.push_back(ch);  // A regular key
+            ++pos;
+            continue;
+        }
+
+        size_t available = inputBuffer.size() - pos;
+        if (available >= 3 && inputBuffer[pos + 1] == '[') {
+            switch (inputBuffer[pos + 2]) {
+                case 'A': keyQueue.push_back((char)1); break; // Up arrow
+                case 'B': keyQueue.push_back((char)2); break; // Down arrow
+                case 'C': keyQueue.push_back((char)3); break; // Right arrow
+                case 'D': keyQueue.push_back((char)4); break; // Left arrow
+                default: keyQueue.push_back('\033'); break;
+            }
+            pos += 3;
+        } else if (available >= 2 && inputBuffer[pos + 1] != '[') {
+            keyQueue.push_back('\033');  // ESC with another key (e.g. Alt+Key)
+            pos += 2;
+        } else if (complete) {
+            keyQueue.push_back('\033');  // If it was just ESC alone (not an arrow), return ESC
+            pos = inputBuffer.size();
+        } else {
+            break;  // The rest of the sequence has not arrived yet
+        }
+    }
+    inputBuffer.erase(0, pos);
+}
+
 char AnsiTerminal::getKeystroke() {
-    char ch;
-    read(STDIN_FILENO, &ch, 1);  
+    if (inputBuffer.empty() && !readInput(-1))
+        return 0;  // Interrupted, e.g. by a window resize
+    char ch = inputBuffer[0];
+    inputBuffer.erase(0, 1);
     return ch;
 }
 
 char AnsiTerminal::getSpecialKey() {
-    char ch = getKeystroke();
-
-    // Check for escape sequences
-    if (ch == '\033') {  // Escape character
-        char next_ch;
-        if (read(STDIN_FILENO, &next_ch, 1) == 1 && next_ch == '[') {
-            char arrow_key;
-            if (read(STDIN_FILENO, &arrow_key, 1) == 1) {
-                switch (arrow_key) {
-                    case 'A': return (char)1; // Up arrow
-                    case 'B': return (char)2; // Down arrow
-                    case 'C': return (char)3; // Right arrow
-                    case 'D': return (char)4; // Left arrow
-                }
-            }
+    while (keyQueue.empty()) {
+        if (inputBuffer.empty()) {
+            if (!readInput(-1))
+                return 0;  // Interrupted, e.g. by a window resize
+            decodeInput(false);
+        } else {
+            // Part of an escape sequence: give the rest a moment, otherwise it was ESC alone
+            decodeInput(!readInput(ESCAPE_TIMEOUT_MS));
         }
-        // If it was just ESC alone (not an arrow), return ESC
-        return '\033';
     }
 
-    // Return the character as-is if it's a regular key
-    return ch;
+    char key = keyQueue.front();
+    keyQueue.pop_front();
+    return key;
+}
+
+bool AnsiTerminal::waitForKey(int timeoutMs) {
+    if (!keyQueue.empty() || !inputBuffer.empty())
+        return true;
+    struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+    return poll(&input, 1, timeoutMs) > 0;
+}
+
+char AnsiTerminal::peekKey() {
+    if (keyQueue.empty() && readInput(0))
+        decodeInput(false);
+    return keyQueue.empty() ? 0 : keyQueue.front();
 }
 
 bool AnsiTerminal::isArrowKey(const char ch) {
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <termios.h>
+#include <csignal>
+#include <deque>
 
 /**
  * @class AnsiTerminal
@@ -12,8 +14,12 @@ class AnsiTerminal {
 public:
     /**
      * @brief Constructor: Sets up the terminal for capturing keystrokes.
+     * @param outputFd The file descriptor frames are written to (standard output by default).
+     * @param captureInput Whether to switch standard input to raw mode and track window resizes;
+     *        false leaves the terminal settings alone and keeps the default 24x80 size,
+     *        for output-only use such as benchmarks.
      */
-    AnsiTerminal();
+    explicit AnsiTerminal(int outputFd = 1, bool captureInput = true);
 
     /**
      * @brief Destructor: Restores the terminal settings to the original state.
@@ -42,8 +48,48 @@ public:
     void clearScreen();
 
     /**
-     * @brief Get a single keystroke from the terminal.
-     * @return The character representing the keystroke.
+     * @brief Start assembling a frame. Text queued until endFrame() is sent in one write.
+     */
+    void beginFrame();
+
+    /**
+     * @brief Queue text at a specified row and column in the current frame.
+     * @param row The row position (1-based index).
+     * @param col The column position (1-based index).
+     * @param text The text to be printed.
+     */
+    void queueAt(int row, int col, const std::string &text);
+
+    /**
+     * @brief Queue text with inverted background at a specified row and column in the current frame.
+     * @param row The row position (1-based index).
+     * @param col The column position (1-based index).
+     * @param text The text to be printed with inverted colors.
+     */
+    void queueInvertedAt(int row, int col, const std::string &text);
+
+    /**
+     * @brief Queue clearing the terminal screen in the current frame.
+     */
+    void queueClearScreen();
+
+    /**
+     * @brief Send the assembled frame with a single write(2), or nothing if it is empty.
+     *        With synchronized output the frame is wrapped in the synchronized-update
+     *        escape sequences, so supporting terminals show it all at once.
+     */
+    void endFrame();
+
+    /**
+     * @brief Enable or disable wrapping frames in synchronized-update sequences (enabled by default).
+     * @param enabled Whether to wrap frames.
+     */
+    void setSynchronizedOutput(bool enabled) { synchronizedOutput = enabled; }
+
+    /**
+     * @brief Get the next byte of input that has not been decoded into a key yet.
+     *        Input is read in bulk, so one read() serves many calls.
+     * @return The byte, or 0 if waiting for input was interrupted.
      */
     char getKeystroke();
 
@@ -51,10 +97,26 @@ public:
      * @brief Get the arrow key or special key input.
      *        Returns 'U', 'D', 'L', 'R' for Up, Down, Left, Right, respectively,
      *        or detects other key combinations such as Alt+Key, Ctrl+Key, etc.
-     * @return A character representing the detected special key.
+     *        Keys are decoded from bulk reads into a queue, so keys that arrived
+     *        together are returned without further system calls.
+     * @return A character representing the detected special key, or 0 if
+     *         waiting for input was interrupted.
      */
     char getSpecialKey();
 
+    /**
+     * @brief Wait until a key can be read without blocking.
+     * @param timeoutMs How long to wait in milliseconds; -1 waits indefinitely.
+     * @return True if a key is available; false on timeout or when interrupted by a resize.
+     */
+    bool waitForKey(int timeoutMs);
+
+    /**
+     * @brief Look at the next key without removing it and without waiting for input.
+     * @return The key getSpecialKey() would return next, or 0 if none has arrived yet.
+     */
+    char peekKey();
+
     /**
      * @brief Check if a character corresponds to an arrow key.
      * @param ch The character to check.
@@ -62,8 +124,66 @@ public:
      */
     bool isArrowKey(const char ch);
 
+    /**
+     * @brief Get the number of rows of the terminal window.
+     * @return The row count as of the last resize (24 if it cannot be determined).
+     */
+    int getRows() const { return rows; }
+
+    /**
+     * @brief Get the number of columns of the terminal window.
+     * @return The column count as of the last resize (80 if it cannot be determined).
+     */
+    int getCols() const { return cols; }
+
+    /**
+     * @brief Check whether the window was resized since the last call, and if so
+     *        refresh the size returned by getRows() and getCols().
+     *        A resize also interrupts a pending getSpecialKey(), which then returns 0.
+     * @return True if the window was resized.
+     */
+    bool checkResize();
+
 private:
     struct termios original_tio; ///< Holds the original terminal settings.
+    struct sigaction original_winch; ///< Holds the original SIGWINCH handler.
+    int rows = 24; ///< The number of rows of the terminal window.
+    int cols = 80; ///< The number of columns of the terminal window.
+    int outputFd; ///< The file descriptor frames are written to.
+    bool captureInput; ///< Whether the terminal settings and the SIGWINCH handler were replaced.
+    bool synchronizedOutput = true; ///< Whether frames are wrapped in synchronized-update sequences.
+    std::string frame; ///< The frame being assembled.
+    std::string inputBuffer; ///< Input read but not decoded into keys yet.
+    std::deque<char> keyQueue; ///< Decoded keys not returned yet.
+
+    /** @brief How long to wait for the rest of an escape sequence before treating ESC as a key. */
+    static constexpr int ESCAPE_TIMEOUT_MS = 30;
+    size_t emptyFrameSize = 0; ///< The size of the frame before anything was queued.
+
+    /**
+     * @brief Wait for input and append everything available to the input buffer.
+     * @param timeoutMs How long to wait in milliseconds; -1 waits indefinitely, 0 not at all.
+     * @return True if input was read.
+     */
+    bool readInput(int timeoutMs);
+
+    /**
+     * @brief Decode the complete keys in the input buffer into the key queue.
+     * @param complete Whether no more input is coming, so a partial escape sequence is ESC alone.
+     */
+    void decodeInput(bool complete);
+
+    /**
+     * @brief Append a cursor positioning sequence to the frame.
+     * @param row The row position (1-based index).
+     * @param col The column position (1-based index).
+     */
+    void queuePosition(int row, int col);
+
+    /**
+     * @brief Query the window size from the terminal with TIOCGWINSZ.
+     */
+    void updateSize();
 };
 
 #endif // ANSI_TERMINAL_H
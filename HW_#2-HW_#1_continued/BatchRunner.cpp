@@ -0,0 +1,222 @@
+#include "BatchRunner.h"
+#include "Cell.h"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <iomanip>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    std::string restOfLine(std::istringstream &args)
+    {
+        std::string rest;
+        std::getline(args >> std::ws, rest);
+        return rest;
+    }
+
+    void replaceAll(std::string &text, const std::string &from, const std::string &to)
+    {
+        for (size_t at = text.find(from); at != std::string::npos; at = text.find(from, at + to.size()))
+            text.replace(at, from.size(), to);
+    }
+}
+
+BatchRunner::BatchRunner(std::ostream &out) : out(out)
+{
+}
+
+int BatchRunner::run(std::istream &script)
+{
+    using Clock = std::chrono::steady_clock;
+    auto scriptStart = Clock::now();
+    int commands = 0;
+    int failures = 0;
+
+    std::string line;
+    for (int lineNumber = 1; std::getline(script, line); ++lineNumber)
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        std::istringstream args(line);
+        std::string command;
+        if (!(args >> command) || command[0] == '#')
+            continue;
+
+        std::string fields;
+        std::string error;
+        auto start = Clock::now();
+        try
+        {
+            execute(command, args, fields);
+        }
+        catch (const std::exception &e)
+        {
+            error = e.what();
+        }
+        double millis = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        ++commands;
+        out << "{\"line\":" << lineNumber << ",\"cmd\":" << jsonString(command)
+            << ",\"ok\":" << (error.empty() ? "true" : "false")
+            << ",\"ms\":" << std::fixed << std::setprecision(3) << millis << fields;
+        if (!error.empty())
+        {
+            ++failures;
+            out << ",\"error\":" << jsonString(error);
+        }
+        out << "}\n";
+    }
+
+    double total = std::chrono::duration<double, std::milli>(Clock::now() - scriptStart).count();
+    out << "{\"cmd\":\"total\",\"commands\":" << commands << ",\"failures\":" << failures
+        << ",\"ms\":" << std::fixed << std::setprecision(3) << total << "}" << std::endl;
+    return failures;
+}
+
+void BatchRunner::execute(const std::string &command, std::istringstream &args, std::string &fields)
+{
+    if (command == "open")
+    {
+        std::string file = restOfLine(args);
+        if (file.empty())
+            throw std::runtime_error("open needs a path");
+
+        auto opened = std::make_unique<Spreadsheet>();
+        opened->setLazyEvaluation(lazy);
+        if (std::filesystem::exists(file))
+            fileHandler.loadFromFile(file, *opened);
+        sheet = std::move(opened);
+        path = file;
+        fields = ",\"rows\":" + std::to_string(sheet->getRowCount()) +
+                 ",\"cols\":" + std::to_string(sheet->getColCount());
+    }
+    else if (command == "set")
+    {
+        Spreadsheet &s = currentSheet();
+        std::pair<int, int> cell = cellArgument(args);
+        s.commitEdit(cell.first, cell.second, restOfLine(args));
+    }
+    else if (command == "bulk")
+    {
+        Spreadsheet &s = currentSheet();
+        std::pair<int, int> from = cellArgument(args);
+        std::pair<int, int> to = cellArgument(args);
+        std::string input = restOfLine(args);
+        if (from.first > to.first)
+            std::swap(from.first, to.first);
+        if (from.second > to.second)
+            std::swap(from.second, to.second);
+
+        std::vector<std::pair<std::pair<int, int>, std::string>> edits;
+        edits.reserve(static_cast<size_t>(to.first - from.first + 1) * (to.second - from.second + 1));
+        for (int r = from.first; r <= to.first; ++r)
+        {
+            for (int c = from.second; c <= to.second; ++c)
+            {
+                std::string text = input;
+                replaceAll(text, "{row}", std::to_string(r + 1));
+                replaceAll(text, "{col}", Cell::columnLetters(c));
+                edits.push_back({{r, c}, std::move(text)});
+            }
+        }
+        s.commitEdits(edits);
+        fields = ",\"cells\":" + std::to_string(edits.size());
+    }
+    else if (command == "recalc")
+    {
+        fields = ",\"formulas\":" + std::to_string(currentSheet().recalculateAll());
+    }
+    else if (command == "get")
+    {
+        Spreadsheet &s = currentSheet();
+        std::pair<int, int> cell = cellArgument(args);
+        std::string value;
+        s.refresh(cell.first, cell.second);
+        if (cell.first < s.getRowCount() && cell.second < s.getColCount())
+            value = s.getCell(cell.first, cell.second)->getValueAsString();
+        fields = ",\"cell\":" + jsonString(Cell::referenceName(cell.first, cell.second)) +
+                 ",\"value\":" + jsonString(value);
+    }
+    else if (command == "lazy")
+    {
+        std::string mode = restOfLine(args);
+        if (mode != "on" && mode != "off")
+            throw std::runtime_error("lazy needs on or off");
+        lazy = mode == "on";
+        if (sheet)
+            sheet->setLazyEvaluation(lazy);
+    }
+    else if (command == "save")
+    {
+        Spreadsheet &s = currentSheet();
+        std::string file = restOfLine(args);
+        if (file.empty() || file == path)
+            fileHandler.saveChanges(path, s);
+        else
+            fileHandler.saveToFile(file, s);
+        fields = ",\"path\":" + jsonString(file.empty() ? path : file);
+    }
+    else
+    {
+        throw std::runtime_error("unknown command");
+    }
+}
+
+std::pair<int, int> BatchRunner::cellArgument(std::istringstream &args) const
+{
+    std::string ref;
+    if (!(args >> ref))
+        throw std::runtime_error("missing cell reference");
+
+    std::pair<int, int> cell = Cell::parseReference(ref);
+    if (cell.first < 0)
+        throw std::runtime_error("invalid cell reference " + ref);
+    if (cell.first >= Spreadsheet::MAX_ROWS || cell.second >= Spreadsheet::MAX_COLS)
+        throw std::runtime_error("cell " + ref + " is outside the sheet");
+    return cell;
+}
+
+Spreadsheet &BatchRunner::currentSheet() const
+{
+    if (!sheet)
+        throw std::runtime_error("no sheet is open");
+    return *sheet;
+}
+
+std::string BatchRunner::jsonString(const std::string &text)
+{
+    std::string quoted = "\"";
+    for (char ch : text)
+    {
+        switch (ch)
+        {
+        case '"':
+            quoted += "\\\"";
+            break;
+        case '\\':
+            quoted += "\\\\";
+            break;
+        case '\n':
+            quoted += "\\n";
+            break;
+        case '\t':
+            quoted += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20)
+            {
+                char escaped[7];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(ch));
+                quoted += escaped;
+            }
+            else
+            {
+                quoted += ch;
+            }
+        }
+    }
+    return quoted + "\"";
+}
@@ -0,0 +1,87 @@
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include "Spreadsheet.h"
+#include "FileHandler.h"
+#include <string>
+#include <memory>
+#include <istream>
+#include <ostream>
+#include <sstream>
+
+/**
+ * @class BatchRunner
+ * @brief Executes a script of spreadsheet commands without a terminal.
+ *
+ * Every line of the script holds one command; blank lines and lines starting
+ * with '#' are ignored. Cells are named in the letter representation, e.g. "B7".
+ *
+ *     open <path>               Loads the file, or starts an empty sheet that is saved to it.
+ *     set <cell> <input>        Commits an edit, exactly as typed into the cell.
+ *     bulk <from> <to> <input>  Fills the rectangle between two cells and recalculates once;
+ *                               "{row}" and "{col}" in the input become the row number and
+ *                               column letters of each filled cell.
+ *     recalc                    Re-evaluates every formula.
+ *     get <cell>                Reports the value of a cell.
+ *     lazy on|off               Switches the open sheet, and those opened later, to lazy or
+ *                               eager evaluation (see Spreadsheet::setLazyEvaluation).
+ *     save [path]               Saves to the given path, or to the opened file.
+ *
+ * Each command reports one JSON object per line with its line number, name,
+ * outcome and duration in milliseconds, followed by a summary line.
+ */
+class BatchRunner
+{
+public:
+    /**
+     * @brief Constructor.
+     * @param out The stream the JSON results are written to.
+     */
+    explicit BatchRunner(std::ostream &out);
+
+    /**
+     * @brief Executes every command of a script; a failed command does not stop the script.
+     * @param script The stream to read the commands from.
+     * @return The number of commands that failed.
+     */
+    int run(std::istream &script);
+
+private:
+    std::ostream &out;                    ///< Receives the JSON results.
+    std::unique_ptr<Spreadsheet> sheet;   ///< The open spreadsheet, or nullptr before "open".
+    std::string path;                     ///< The file the open spreadsheet belongs to.
+    FileHandler fileHandler;              ///< Loads and saves the spreadsheet.
+    bool lazy = false;                    ///< Whether sheets evaluate lazily, set by "lazy".
+
+    /**
+     * @brief Executes one command.
+     * @param command The command name.
+     * @param args The rest of the line, positioned after the command name.
+     * @param fields Receives extra result fields, each formatted as ,"name":value.
+     * @throws std::runtime_error If the command is unknown, malformed or fails.
+     */
+    void execute(const std::string &command, std::istringstream &args, std::string &fields);
+
+    /**
+     * @brief Reads a cell reference argument.
+     * @param args The arguments of the command.
+     * @return The (row, column) of the cell; it may lie beyond the current grid.
+     * @throws std::runtime_error If the argument is missing, invalid or past MAX_ROWS / MAX_COLS.
+     */
+    std::pair<int, int> cellArgument(std::istringstream &args) const;
+
+    /**
+     * @brief Returns the open spreadsheet.
+     * @throws std::runtime_error If no spreadsheet was opened yet.
+     */
+    Spreadsheet &currentSheet() const;
+
+    /**
+     * @brief Quotes a string as a JSON string literal.
+     * @param text The string to quote.
+     * @return The quoted and escaped string.
+     */
+    static std::string jsonString(const std::string &text);
+};
+
+#endif
@@ -1,20 +1,137 @@
 #include "Cell.h"
+#include "FormulaProgram.h"
 #include <string>
-
+#include <climits>
+    
+const char *errorText(CellError error)
+{
+    switch (error)
+    {
+    case CellError::DIV0:
+        return "#DIV/0!";
+    case CellError::REF:
+        return "#REF!";
+    case CellError::VALUE:
+        return "#VALUE!";
+    case CellError::CYCLE:
+        return "#CYCLE!";
+    case CellError::NAME:
+        return "#NAME?";
+    case CellError::NONE:
+        break;
+    }
+    return "";
+}
+    
 void Cell::setLetterRepresentation(int row, int col)
 {
-    int c = col;
-    std::string letter;
-
-    while (c >= 0)
+    letter_rep = referenceName(row, col);
+}
+    
+void Cell::appendColumnLetters(std::string &out, int col)
+{
+    char letters[8];
+    size_t length = 0;
+    for (int c = col; c >= 0 && length < sizeof(letters); c = c / 26 - 1)
+        letters[length++] = static_cast<char>('A' + c % 26);
+    while (length > 0)
+        out += letters[--length];
+}
+    
+std::string Cell::columnLetters(int col)
+{
+    std::string letters;
+    appendColumnLetters(letters, col);
+    return letters;
+}
+    
+std::string Cell::referenceName(int row, int col)
+{
+    std::string name;
+    appendColumnLetters(name, col);
+    return name + std::to_string(row + 1);
+}
+    
+std::pair<int, int> Cell::parseReference(std::string_view ref)
+{
+    const std::pair<int, int> invalid(-1, -1);
+    size_t i = 0;
+    long long col = 0;
+    for (; i < ref.size() && ref[i] >= 'A' && ref[i] <= 'Z'; ++i)
+    {
+        col = col * 26 + (ref[i] - 'A' + 1); // Inverse of setLetterRepresentation
+        if (col > INT_MAX)
+            return invalid;
+    }
+    if (i == 0 || i == ref.size() || ref[i] == '0')
+        return invalid; // No letters, no digits or a leading zero
+    
+    long long row = 0;
+    for (; i < ref.size(); ++i)
     {
-        letter = static_cast<char>('A' + (c % 26)) + letter;
-        c = c / 26 - 1;
+        if (ref[i] < '0' || ref[i] > '9')
+            return invalid;
+        row = row * 10 + (ref[i] - '0');
+        if (row > INT_MAX)
+            return invalid;
     }
+    return {static_cast<int>(row - 1), static_cast<int>(col - 1)};
+}
     
-    letter_rep = letter + std::to_string(row + 1);
+void FormulaCell::addDependentCell(const std::pair<int, int> &coor)
+{
+    int r = coor.first;
+    int c = coor.second;
+    if (!dependentRanges.empty())
+    {
+        CellRect &last = dependentRanges.back();
+        if (last.contains(coor))
+            return;
+    
+        if (last.top == last.bottom && r == last.top && c == last.right + 1)
+            ++last.right; // Continues a run along a row
+        else if (last.left == last.right && c == last.left && r == last.bottom + 1)
+            ++last.bottom; // Continues a run down a column
+        else
+        {
+            dependentRanges.push_back({r, c, r, c});
+            return;
+        }
+    
+        // A finished row as wide as the rectangle above it joins that rectangle.
+        size_t count = dependentRanges.size();
+        if (count >= 2 && last.top == last.bottom)
+        {
+            CellRect &above = dependentRanges[count - 2];
+            if (above.left == last.left && above.right == last.right && above.bottom + 1 == last.top)
+            {
+                above.bottom = last.bottom;
+                dependentRanges.pop_back();
+            }
+        }
+        return;
+    }
+    dependentRanges.push_back({r, c, r, c});
 }
+    
+bool FormulaCell::replaceDependentCells(const std::pair<int, int> *first, const std::pair<int, int> *last)
+{
+    spc::smallvec<CellRect, 2> previous = std::move(dependentRanges);
+    for (; first != last; ++first)
+        addDependentCell(*first);
 
+    if (previous.size() != dependentRanges.size())
+        return true;
+    for (size_t i = 0; i < previous.size(); ++i)
+    {
+        const CellRect &a = previous[i];
+        const CellRect &b = dependentRanges[i];
+        if (a.top != b.top || a.left != b.left || a.bottom != b.bottom || a.right != b.right)
+            return true;
+    }
+    return false;
+}
+    
 double Cell::getCellValueAsDouble()
 {
     if (auto *intCell = dynamic_cast<IntValueCell *>(this))
@@ -33,4 +150,29 @@ double Cell::getCellValueAsDouble()
     {
         return 0.0;
     }
-}
\ No newline at end of file
+}
+    
+const std::string &Cell::getDisplayText(int width) const
+{
+    if (displayWidth != width)
+    {
+        std::string text = getValueAsString();
+        if (static_cast<int>(text.length()) >= width)
+            displayText = text.substr(0, width - 2) + ">";
+        else
+            displayText = std::string(width - 1 - text.length(), ' ') + text;
+        displayWidth = width;
+    }
+    return displayText;
+}
+    
+
+std::string FormulaCell::getFormula() const
+{
+    return formula->render(getRow(), getCol());
+}
+
+size_t FormulaCell::memoryUsage() const
+{
+    return sizeof(FormulaCell) + baseHeapUsage() + dependentRanges.heapUsage() + formula->memoryUsage() / formula.use_count();
+}
@@ -1,11 +1,63 @@
 #ifndef CELL_H
 #define CELL_H
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <sstream>
 #include <iomanip>
+#include <charconv>
+#include <memory>
 #include "myvec.h"
+#include "smallvec.h"
+
+/**
+ * A rectangle of cells, inclusive on all sides.
+ * Formula cells store the cells they read as rectangles, so a range such as
+ * A1..J100 is one entry rather than a thousand.
+ */
+struct CellRect
+{
+    int top;    ///< First row.
+    int left;   ///< First column.
+    int bottom; ///< Last row.
+    int right;  ///< Last column.
+
+    /**
+     * Checks whether a cell lies inside the rectangle.
+     * @param cell The (row, column) to check.
+     * @return True if the cell is covered.
+     */
+    bool contains(const std::pair<int, int> &cell) const
+    {
+        return cell.first >= top && cell.first <= bottom && cell.second >= left && cell.second <= right;
+    }
+};
+
+/**
+ * An error a formula evaluates to instead of a number.
+ * Errors are ordinary values: a formula that reads a cell holding one evaluates to
+ * the same error, so it shows up in every cell downstream of the broken input.
+ */
+enum class CellError
+{
+    NONE,  ///< No error; the formula has a number.
+    DIV0,  ///< Division by zero.
+    REF,   ///< A reference outside the sheet.
+    VALUE, ///< A malformed formula.
+    CYCLE, ///< The formula reads itself, directly or through other formulas.
+    NAME   ///< An unknown function or name.
+};
+
+/**
+ * Returns the text shown in place of the value of a cell holding an error.
+ * @param error The error.
+ * @return E.g. "#DIV/0!"; empty for CellError::NONE.
+ */
+const char *errorText(CellError error);
+
+struct FormulaTemplate;
 
 /**
  * Abstract base class representing a generic spreadsheet cell.
@@ -40,6 +92,33 @@ public:
      */
     void setLetterRepresentation(int r, int c);
 
+    /**
+     * Parses a cell reference in the letter representation, e.g. "A1" or "AB12".
+     * @param ref The reference, without surrounding spaces.
+     * @return The (row, column) it names, or (-1, -1) if it is not a valid reference.
+     */
+    static std::pair<int, int> parseReference(std::string_view ref);
+
+    /**
+     * Appends the letters naming a column, e.g. "AB" for column 27.
+     * @param out The string to append to.
+     * @param col Column index (must be non-negative).
+     */
+    static void appendColumnLetters(std::string &out, int col);
+
+    /**
+     * Returns the letters naming a column, e.g. "AB" for column 27.
+     * @param col Column index (must be non-negative).
+     */
+    static std::string columnLetters(int col);
+
+    /**
+     * Returns the letter representation of a cell, e.g. "AB12"; the inverse of parseReference.
+     * @param row Row index.
+     * @param col Column index.
+     */
+    static std::string referenceName(int row, int col);
+
     /**
      * Retrieves the letter representation of the cell.
      * @return String representing the cell's location (e.g., "A1").
@@ -65,15 +144,59 @@ public:
      */
     double getCellValueAsDouble();
 
+    /**
+     * Retrieves the error the cell evaluates to, if any.
+     * @return CellError::NONE unless the cell is a formula that failed.
+     */
+    virtual CellError getError() const { return CellError::NONE; }
+
     /**
      * Pure virtual method to retrieve the cell's value as a string.
      * @return Cell value as a string.
      */
     virtual std::string getValueAsString() const = 0;
 
+    /**
+     * Retrieves the cell's value formatted for a column of the given width.
+     * The text is cached until the value or the width changes.
+     * @param width Column width in characters, including the separator.
+     * @return Value right-aligned in width - 1 characters, or cut off with '>' if too long.
+     */
+    const std::string &getDisplayText(int width) const;
+
+    /**
+     * Estimates the memory used by the cell, including what its members allocate.
+     * @return Size in bytes.
+     */
+    virtual size_t memoryUsage() const = 0;
+
+protected:
+    /**
+     * Discards the cached display text; called whenever the value changes.
+     */
+    void invalidateDisplay() { displayWidth = -1; }
+
+    /**
+     * Memory allocated by the members of the Cell base class.
+     * @return Size in bytes.
+     */
+    size_t baseHeapUsage() const { return heapUsage(letter_rep) + heapUsage(displayText); }
+
+    /**
+     * Memory a string allocates beyond its own object (none for short strings).
+     * @param s The string.
+     * @return Size in bytes.
+     */
+    static size_t heapUsage(const std::string &s)
+    {
+        return s.capacity() > std::string().capacity() ? s.capacity() + 1 : 0;
+    }
+
 private:
     std::string letter_rep; ///< String representation of the cell's location.
     int row, col; ///< Row and column indices.
+    mutable std::string displayText; ///< Cached result of getDisplayText.
+    mutable int displayWidth = -1; ///< Width displayText was formatted for, or -1 if stale.
 };
 
 /**
@@ -87,16 +210,53 @@ public:
      * Constructor for FormulaCell.
      * @param r Row index.
      * @param c Column index.
-     * @param f Formula string.
+     * @param f The compiled formula, possibly shared with other cells (see FormulaParser::compile).
      */
-    FormulaCell(int r, int c, const std::string &f)
-        : Cell(r, c), formula(f), calculatedValue(0) {}
+    FormulaCell(int r, int c, std::shared_ptr<const FormulaTemplate> f)
+        : Cell(r, c), formula(std::move(f)), calculatedValue(0) {}
 
     /**
      * Sets the calculated value for the formula.
      * @param value The new calculated value.
      */
-    void setCalculatedValue(double value) { calculatedValue = value; }
+    void setCalculatedValue(double value)
+    {
+        if (value != calculatedValue || error != CellError::NONE)
+            invalidateDisplay();
+        calculatedValue = value;
+        error = CellError::NONE;
+    }
+
+    /**
+     * Replaces the calculated value with an error; the value reads as 0 until the next success.
+     * @param e The error the formula evaluated to.
+     */
+    void setError(CellError e)
+    {
+        if (e != error)
+            invalidateDisplay();
+        calculatedValue = 0;
+        error = e;
+    }
+
+    /**
+     * Records when the calculated value was last brought up to date.
+     * @param generation The parser's generation at the time; 0 marks the value stale
+     *        (see FormulaParser::isStale).
+     */
+    void setComputedAt(uint32_t generation) { computedAt = generation; }
+
+    /**
+     * Retrieves when the calculated value was last brought up to date.
+     * @return The parser's generation at the time, or 0 if the value was marked stale since.
+     */
+    uint32_t getComputedAt() const { return computedAt; }
+
+    /**
+     * Retrieves the error the formula evaluated to.
+     * @return The error, or CellError::NONE if the calculated value is valid.
+     */
+    CellError getError() const override { return error; }
 
     /**
      * Retrieves the calculated value of the formula.
@@ -105,35 +265,75 @@ public:
     double getCalculatedValue() const { return calculatedValue; }
 
     /**
-     * Retrieves the formula string.
+     * Retrieves the formula string, as entered in this cell.
      * @return Formula string.
      */
-    const std::string &getFormula() const { return formula; }
+    std::string getFormula() const;
+
+    /**
+     * Retrieves the compiled formula.
+     * @return The template; cells filled with the same relative formula return the same one.
+     */
+    const FormulaTemplate &getTemplate() const { return *formula; }
 
     /**
-     * Adds a dependent cell to the list.
+     * Adds a dependent cell to the list. Cells are expected in reading order, as
+     * the parser produces them: runs along a row, along a column and rows of equal
+     * width stacked on each other are merged into one rectangle.
      * @param coor Pair representing the dependent cell's coordinates.
      */
-    void addDependentCell(const std::pair<int, int> &coor) { dependentCells.push_back(coor); }
+    void addDependentCell(const std::pair<int, int> &coor);
+
+    /**
+     * Replaces the list of dependent cells after the formula was evaluated again.
+     * @param first The first dependent cell, in reading order as for addDependentCell.
+     * @param last One past the last dependent cell.
+     * @return True if the rectangles changed and must be registered again.
+     */
+    bool replaceDependentCells(const std::pair<int, int> *first, const std::pair<int, int> *last);
+
+    /**
+     * Retrieves the dependent cells as rectangles.
+     * @return The rectangles; together they cover every dependent cell, without overlap
+     *         as long as no cell was added twice.
+     */
+    const spc::smallvec<CellRect, 2> &fetchDependentRanges() const { return dependentRanges; }
 
     /**
-     * Retrieves the list of dependent cells.
-     * @return Vector of dependent cell coordinates.
+     * Calls a function for every dependent cell.
+     * @param visit Called with the (row, column) of each dependent cell.
      */
-    const spc::myvec<std::pair<int, int>> &fetchDependentCells() const { return dependentCells; }
+    template <typename Visit>
+    void forEachDependentCell(Visit visit) const
+    {
+        for (const CellRect &rect : dependentRanges)
+            for (int r = rect.top; r <= rect.bottom; ++r)
+                for (int c = rect.left; c <= rect.right; ++c)
+                    visit(std::pair<int, int>(r, c));
+    }
 
     /**
      * Clears the list of dependent cells.
      */
-    void clearDependentCells() { dependentCells.clear(); }
+    void clearDependentCells() { dependentRanges.clear(); }
 
     /**
      * Retrieves the cell's value as a string.
      * Formats the value as an integer or double based on precision.
-     * @return Formatted value string.
+     * @return Formatted value string, or the error text if the formula failed.
      */
     std::string getValueAsString() const override
     {
+        if (error != CellError::NONE)
+            return errorText(error);
+
+        char buffer[64];
+        auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), calculatedValue,
+                                       std::chars_format::fixed, isInteger(calculatedValue) ? 0 : 2);
+        if (ec == std::errc())
+            return std::string(buffer, end);
+
+        // Too long for the buffer
         std::ostringstream oss;
 
         if (isInteger(calculatedValue))
@@ -148,6 +348,12 @@ public:
         return oss.str();
     }
 
+    /**
+     * Estimates the memory used by the cell, counting its share of the template.
+     * @return Size in bytes.
+     */
+    size_t memoryUsage() const override;
+
 private:
     /**
      * Checks if a double value is an integer.
@@ -159,9 +365,11 @@ private:
         return calculatedValue == static_cast<int>(calculatedValue);
     }
 
-    std::string formula; ///< The formula string.
+    CellError error = CellError::NONE; ///< The error the formula evaluated to, if any. Declared first so it fits in Cell's tail padding.
+    uint32_t computedAt = 0; ///< Generation the value was computed in; see setComputedAt.
+    std::shared_ptr<const FormulaTemplate> formula; ///< The compiled formula, shared by cells holding the same one.
     double calculatedValue; ///< The calculated value of the formula.
-    spc::myvec<std::pair<int, int>> dependentCells; ///< List of dependent cell coordinates.
+    spc::smallvec<CellRect, 2> dependentRanges; ///< Dependent cells, merged into rectangles.
 };
 
 /**
@@ -220,11 +428,21 @@ public:
      */
     int getValue() const { return val; }
 
+    /**
+     * Estimates the memory used by the cell.
+     * @return Size in bytes.
+     */
+    size_t memoryUsage() const override { return sizeof(IntValueCell) + baseHeapUsage(); }
+
     /**
      * Sets the integer value of the cell.
      * @param v New value as a string.
      */
-    void setValue(const std::string &v) { val = std::stoi(v); }
+    void setValue(const std::string &v)
+    {
+        val = std::stoi(v);
+        invalidateDisplay();
+    }
 
 private:
     int val; ///< Integer value stored in the cell.
@@ -260,11 +478,21 @@ public:
      */
     std::string getValue() const { return val; }
 
+    /**
+     * Estimates the memory used by the cell.
+     * @return Size in bytes.
+     */
+    size_t memoryUsage() const override { return sizeof(StringValueCell) + baseHeapUsage() + heapUsage(val); }
+
     /**
      * Sets the string value of the cell.
      * @param v New value as a string.
      */
-    void setValue(const std::string &v) { val = v; }
+    void setValue(const std::string &v)
+    {
+        val = v;
+        invalidateDisplay();
+    }
 
 private:
     std::string val; ///< String value stored in the cell.
@@ -291,9 +519,10 @@ public:
      */
     std::string getValueAsString() const override
     {
-        std::ostringstream oss;
-        oss << val;
-        return oss.str();
+        // Same output as streaming the value with the default precision of 6
+        char buffer[32];
+        auto end = std::to_chars(buffer, buffer + sizeof(buffer), val, std::chars_format::general, 6).ptr;
+        return std::string(buffer, end);
     }
 
     /**
@@ -302,11 +531,21 @@ public:
      */
     double getValue() const { return val; }
 
+    /**
+     * Estimates the memory used by the cell.
+     * @return Size in bytes.
+     */
+    size_t memoryUsage() const override { return sizeof(DoubleValueCell) + baseHeapUsage(); }
+
     /**
      * Sets the double value of the cell.
      * @param v New value as a string.
      */
-    void setValue(const std::string &v) { val = std::stod(v); }
+    void setValue(const std::string &v)
+    {
+        val = std::stod(v);
+        invalidateDisplay();
+    }
 
 private:
     double val; ///< Double value stored in the cell.
@@ -0,0 +1,42 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace spc
+{
+
+    /**
+     * @brief Computes the CRC-32 (IEEE) checksum of a buffer.
+     * @param data Pointer to the bytes to checksum.
+     * @param len Number of bytes.
+     * @return The checksum.
+     */
+    inline uint32_t crc32(const char *data, size_t len)
+    {
+        struct Table
+        {
+            uint32_t entries[256];
+            Table()
+            {
+                for (uint32_t i = 0; i < 256; ++i)
+                {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; ++k)
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    entries[i] = c;
+                }
+            }
+        };
+        static const Table table;
+
+        uint32_t crc = 0xFFFFFFFFu;
+        for (size_t i = 0; i < len; ++i)
+            crc = table.entries[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+        return crc ^ 0xFFFFFFFFu;
+    }
+
+} // namespace spc
+
+#endif // CHECKSUM_H
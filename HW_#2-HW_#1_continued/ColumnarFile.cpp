@@ -0,0 +1,736 @@
+#include "ColumnarFile.h"
+#include "Spreadsheet.h"
+#include "Checksum.h"
+#include "Cell.h"
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>    // For open()
+#include <unistd.h>   // For pwrite() and fsync()
+
+namespace
+{
+    const char MAGIC[4] = {'S', 'C', 'O', 'L'};
+    const uint32_t VERSION = 3;
+    const size_t HEADER_SIZE = 32;     // magic, version, index offset, rows, cols, tile rows, reserved
+    const size_t INDEX_HEADER_SIZE = 12; // entry count, offset of the amended index
+    const size_t INDEX_ENTRY_SIZE = 21;
+    const int MAX_DECIMALS = 9;          // Most decimal digits numbers are scaled by
+    const uint8_t RAW_NUMBERS = 0xFF;    // Marks numbers no scale keeps exact, stored as doubles
+    const double MAX_EXACT = 9007199254740992.0; // 2^53, the largest scaled number kept exactly
+
+    enum TileKind : uint8_t
+    {
+        TILE_EMPTY = 0,
+        TILE_INT = 1,
+        TILE_DOUBLE = 2,
+        TILE_MIXED = 3
+    };
+
+    template <typename T>
+    void put(std::string &out, T value)
+    {
+        char buf[sizeof(T)];
+        std::memcpy(buf, &value, sizeof(T));
+        out.append(buf, sizeof(T));
+    }
+
+    /**
+     * Sequential reader over an encoded buffer; throws on reads past the end.
+     */
+    class Reader
+    {
+    public:
+        Reader(const char *d, size_t n) : data(d), size(n), pos(0) {}
+
+        template <typename T>
+        T get()
+        {
+            need(sizeof(T));
+            T value;
+            std::memcpy(&value, data + pos, sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        std::string getBytes(size_t n)
+        {
+            need(n);
+            std::string s(data + pos, n);
+            pos += n;
+            return s;
+        }
+
+        /** Reads an unsigned value written by putVarint. */
+        uint64_t getVarint()
+        {
+            uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                uint8_t byte = get<uint8_t>();
+                value |= uint64_t(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                    return value;
+            }
+            throw std::runtime_error("Columnar file is malformed.");
+        }
+
+        const char *cursor() const { return data + pos; }
+        size_t remaining() const { return size - pos; }
+        void skip(size_t n) { need(n); pos += n; }
+
+    private:
+        void need(size_t n) const
+        {
+            if (n > size - pos)
+                throw std::runtime_error("Columnar file is truncated.");
+        }
+
+        const char *data;
+        size_t size;
+        size_t pos;
+    };
+
+    /** Appends an unsigned value in groups of seven bits, lowest first. */
+    void putVarint(std::string &out, uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    /** Packs unsigned values of a fixed bit width into bytes. */
+    void packBits(std::string &out, const std::vector<uint64_t> &values, int width)
+    {
+        uint64_t acc = 0;
+        int bits = 0;
+        for (uint64_t v : values)
+        {
+            for (int done = 0; done < width;)
+            {
+                int take = std::min(width - done, 64 - bits);
+                uint64_t part = (take == 64) ? v : (v >> done) & ((uint64_t(1) << take) - 1);
+                acc |= part << bits;
+                bits += take;
+                done += take;
+                if (bits == 64)
+                {
+                    put(out, acc);
+                    acc = 0;
+                    bits = 0;
+                }
+            }
+        }
+        for (int i = 0; i < bits; i += 8)
+            out.push_back(static_cast<char>((acc >> i) & 0xFF));
+    }
+
+    /** Inverse of packBits. */
+    std::vector<uint64_t> unpackBits(Reader &in, size_t count, int width)
+    {
+        size_t bytes = (count * width + 7) / 8;
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(in.cursor());
+        in.skip(bytes);
+
+        std::vector<uint64_t> values(count);
+        size_t bit = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint64_t v = 0;
+            for (int done = 0; done < width; ++done, ++bit)
+                v |= uint64_t((p[bit / 8] >> (bit % 8)) & 1) << done;
+            values[i] = v;
+        }
+        return values;
+    }
+
+    int bitWidth(uint64_t maxValue)
+    {
+        int width = 0;
+        while (width < 64 && (maxValue >> width) != 0)
+            ++width;
+        return width;
+    }
+
+    uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+    int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+    /** Writes a whole buffer at a file offset, retrying short writes. */
+    bool writeAt(int fd, const char *data, size_t length, off_t offset)
+    {
+        while (length > 0)
+        {
+            ssize_t written = ::pwrite(fd, data, length, offset);
+            if (written <= 0)
+                return false;
+            data += written;
+            length -= written;
+            offset += written;
+        }
+        return true;
+    }
+
+    double powerOfTen(int exponent)
+    {
+        double power = 1;
+        for (int i = 0; i < exponent; ++i)
+            power *= 10;
+        return power;
+    }
+
+    /**
+     * Writes numbers as integers scaled by the fewest decimal digits that keep every one
+     * exact: the digit count, the first integer, then zigzag deltas between neighbours,
+     * bit packed. Numbers no scale keeps exact, e.g. 0.1 + 0.2, are written raw instead.
+     */
+    void putNumbers(std::string &out, const std::vector<double> &values)
+    {
+        if (values.empty())
+            return;
+
+        std::vector<int64_t> scaled;
+        int decimals = 0;
+        for (; decimals <= MAX_DECIMALS; ++decimals)
+        {
+            double scale = powerOfTen(decimals);
+            scaled.clear();
+            for (double v : values)
+            {
+                double rounded = std::nearbyint(v * scale);
+                if (!(std::fabs(rounded) <= MAX_EXACT))
+                    break;
+                double restored = static_cast<double>(static_cast<int64_t>(rounded)) / scale;
+                if (restored != v || std::signbit(restored) != std::signbit(v))
+                    break;
+                scaled.push_back(static_cast<int64_t>(rounded));
+            }
+            if (scaled.size() == values.size())
+                break;
+        }
+
+        if (decimals > MAX_DECIMALS)
+        {
+            put<uint8_t>(out, RAW_NUMBERS);
+            for (double v : values)
+                put<double>(out, v);
+            return;
+        }
+
+        std::vector<uint64_t> deltas;
+        for (size_t i = 1; i < scaled.size(); ++i)
+            deltas.push_back(zigzag(scaled[i] - scaled[i - 1]));
+        int width = bitWidth(deltas.empty() ? 0 : *std::max_element(deltas.begin(), deltas.end()));
+        put<uint8_t>(out, static_cast<uint8_t>(decimals));
+        putVarint(out, zigzag(scaled[0]));
+        put<uint8_t>(out, static_cast<uint8_t>(width));
+        packBits(out, deltas, width);
+    }
+
+    /** Inverse of putNumbers. */
+    std::vector<double> getNumbers(Reader &in, size_t count)
+    {
+        std::vector<double> values(count);
+        if (count == 0)
+            return values;
+
+        uint8_t decimals = in.get<uint8_t>();
+        if (decimals == RAW_NUMBERS)
+        {
+            for (double &v : values)
+                v = in.get<double>();
+            return values;
+        }
+        if (decimals > MAX_DECIMALS)
+            throw std::runtime_error("Columnar tile is malformed.");
+
+        double scale = powerOfTen(decimals);
+        int64_t value = unzigzag(in.getVarint());
+        int width = in.get<uint8_t>();
+        if (width > 64)
+            throw std::runtime_error("Columnar tile is malformed.");
+        std::vector<uint64_t> deltas = unpackBits(in, count - 1, width);
+        for (size_t k = 0; k < count; ++k)
+        {
+            if (k > 0)
+                value += unzigzag(deltas[k - 1]);
+            values[k] = static_cast<double>(value) / scale;
+        }
+        return values;
+    }
+}
+
+bool ColumnarFile::isColumnarPath(const std::string &path)
+{
+    const std::string ext = ".scol";
+    return path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+ColumnarFile::StoredCell ColumnarFile::storeCell(const Spreadsheet &sheet, int row, int col) const
+{
+    StoredCell stored;
+    Cell *cell = sheet.getCell(row, col);
+
+    if (auto *formulaCell = dynamic_cast<FormulaCell *>(cell))
+    {
+        stored.type = StoredCell::FORMULA;
+        stored.text = formulaCell->getFormula();
+    }
+    else if (auto *intCell = dynamic_cast<IntValueCell *>(cell))
+    {
+        stored.type = StoredCell::INT;
+        stored.intValue = intCell->getValue();
+    }
+    else if (auto *doubleCell = dynamic_cast<DoubleValueCell *>(cell))
+    {
+        stored.type = StoredCell::DOUBLE;
+        stored.doubleValue = doubleCell->getValue();
+    }
+    else
+    {
+        stored.text = cell->getValueAsString();
+        if (!stored.text.empty())
+            stored.type = StoredCell::STRING;
+    }
+    return stored;
+}
+
+std::string ColumnarFile::encodeTile(const Spreadsheet &sheet, int col, int block, TileInfo &info) const
+{
+    int firstRow = block * TILE_ROWS;
+    int count = std::min(TILE_ROWS, sheet.getRowCount() - firstRow);
+
+    std::vector<StoredCell> cells;
+    uint64_t presence = 0;
+    bool allInt = true, allDouble = true, anyPresent = false;
+
+    for (int i = 0; i < count; ++i)
+    {
+        StoredCell stored = storeCell(sheet, firstRow + i, col);
+        if (stored.type != StoredCell::EMPTY)
+        {
+            presence |= uint64_t(1) << i;
+            anyPresent = true;
+            allInt = allInt && stored.type == StoredCell::INT;
+            allDouble = allDouble && stored.type == StoredCell::DOUBLE;
+        }
+        cells.push_back(std::move(stored));
+    }
+
+    std::string out;
+    info.kind = !anyPresent ? TILE_EMPTY : allInt ? TILE_INT : allDouble ? TILE_DOUBLE : TILE_MIXED;
+    put<uint8_t>(out, info.kind);
+    put<uint16_t>(out, static_cast<uint16_t>(count));
+    put<uint64_t>(out, presence);
+
+    if (info.kind == TILE_MIXED)
+    {
+        // The type of each present cell in two bits: int, double, string or formula.
+        std::vector<uint64_t> types;
+        for (const StoredCell &stored : cells)
+            if (stored.type != StoredCell::EMPTY)
+                types.push_back(stored.type - StoredCell::INT);
+        packBits(out, types, 2);
+    }
+
+    std::vector<double> numbers;
+    for (const StoredCell &stored : cells)
+    {
+        if (stored.type == StoredCell::INT)
+            numbers.push_back(static_cast<double>(stored.intValue));
+        else if (stored.type == StoredCell::DOUBLE)
+            numbers.push_back(stored.doubleValue);
+    }
+    putNumbers(out, numbers);
+
+    if (info.kind == TILE_MIXED)
+    {
+        // Distinct texts in first-seen order, then one bit-packed dictionary index per text cell.
+        std::vector<const std::string *> dictionary;
+        std::vector<uint64_t> indices;
+        for (const StoredCell &stored : cells)
+        {
+            if (stored.type != StoredCell::STRING && stored.type != StoredCell::FORMULA)
+                continue;
+            auto it = std::find_if(dictionary.begin(), dictionary.end(),
+                                   [&stored](const std::string *d) { return *d == stored.text; });
+            indices.push_back(it - dictionary.begin());
+            if (it == dictionary.end())
+                dictionary.push_back(&stored.text);
+        }
+
+        putVarint(out, dictionary.size());
+        for (const std::string *entry : dictionary)
+        {
+            putVarint(out, entry->size());
+            out += *entry;
+        }
+        int width = bitWidth(dictionary.empty() ? 0 : dictionary.size() - 1);
+        put<uint8_t>(out, static_cast<uint8_t>(width));
+        packBits(out, indices, width);
+    }
+    return out;
+}
+
+std::vector<ColumnarFile::StoredCell> ColumnarFile::decodeTile(const char *data, size_t length) const
+{
+    Reader in(data, length);
+    uint8_t kind = in.get<uint8_t>();
+    uint16_t count = in.get<uint16_t>();
+    uint64_t presence = in.get<uint64_t>();
+    if (count > TILE_ROWS)
+        throw std::runtime_error("Columnar tile is malformed.");
+    if (kind > TILE_MIXED)
+        throw std::runtime_error("Columnar tile has an unknown encoding.");
+
+    std::vector<StoredCell> cells(count);
+    if (kind == TILE_EMPTY)
+        return cells;
+
+    std::vector<int> present;
+    for (int i = 0; i < count; ++i)
+        if (presence & (uint64_t(1) << i))
+            present.push_back(i);
+
+    std::vector<StoredCell::Type> types(present.size(), kind == TILE_INT ? StoredCell::INT : StoredCell::DOUBLE);
+    if (kind == TILE_MIXED)
+    {
+        std::vector<uint64_t> bits = unpackBits(in, present.size(), 2);
+        for (size_t k = 0; k < present.size(); ++k)
+            types[k] = static_cast<StoredCell::Type>(bits[k] + StoredCell::INT);
+    }
+
+    size_t numeric = std::count_if(types.begin(), types.end(), [](StoredCell::Type type) {
+        return type == StoredCell::INT || type == StoredCell::DOUBLE;
+    });
+    std::vector<double> numbers = getNumbers(in, numeric);
+
+    std::vector<int> textRows;
+    size_t nextNumber = 0;
+    for (size_t k = 0; k < present.size(); ++k)
+    {
+        StoredCell &cell = cells[present[k]];
+        cell.type = types[k];
+        if (cell.type == StoredCell::INT)
+            cell.intValue = static_cast<int64_t>(numbers[nextNumber++]);
+        else if (cell.type == StoredCell::DOUBLE)
+            cell.doubleValue = numbers[nextNumber++];
+        else
+            textRows.push_back(present[k]);
+    }
+
+    if (kind == TILE_MIXED)
+    {
+        uint64_t entries = in.getVarint();
+        if (entries > in.remaining())
+            throw std::runtime_error("Columnar tile is malformed.");
+        std::vector<std::string> dictionary(entries);
+        for (std::string &entry : dictionary)
+            entry = in.getBytes(in.getVarint());
+        int width = in.get<uint8_t>();
+        if (width > 64)
+            throw std::runtime_error("Columnar tile is malformed.");
+        std::vector<uint64_t> indices = unpackBits(in, textRows.size(), width);
+
+        for (size_t k = 0; k < textRows.size(); ++k)
+        {
+            if (indices[k] >= dictionary.size())
+                throw std::runtime_error("Columnar tile is malformed.");
+            cells[textRows[k]].text = dictionary[indices[k]];
+        }
+    }
+    return cells;
+}
+
+void ColumnarFile::write(const std::string &path, const Spreadsheet &sheet)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        throw std::runtime_error("File could not open.");
+
+    int rows = sheet.getRowCount();
+    int cols = sheet.getColCount();
+    int blocks = (rows + TILE_ROWS - 1) / TILE_ROWS;
+
+    std::string header(MAGIC, 4);
+    put<uint32_t>(header, VERSION);
+    put<uint64_t>(header, 0); // index offset, patched below
+    put<uint32_t>(header, rows);
+    put<uint32_t>(header, cols);
+    put<uint32_t>(header, TILE_ROWS);
+    put<uint32_t>(header, 0);
+    file.write(header.data(), header.size());
+
+    std::vector<TileInfo> index;
+    uint64_t offset = HEADER_SIZE;
+    for (int c = 0; c < cols; ++c)
+    {
+        for (int b = 0; b < blocks; ++b)
+        {
+            TileInfo info;
+            std::string tile = encodeTile(sheet, c, b, info);
+            info.col = c;
+            info.block = b;
+            info.offset = offset;
+            info.length = static_cast<uint32_t>(tile.size());
+            file.write(tile.data(), tile.size());
+            offset += tile.size();
+            index.push_back(info);
+        }
+    }
+
+    std::string encodedIndex = encodeIndex(index, 0);
+    file.write(encodedIndex.data(), encodedIndex.size());
+
+    file.seekp(8);
+    file.write(reinterpret_cast<const char *>(&offset), sizeof(offset));
+    file.close();
+    if (file.fail())
+        throw std::runtime_error("File could not be written.");
+}
+
+std::string ColumnarFile::encodeIndex(const std::vector<TileInfo> &index, uint64_t amends) const
+{
+    std::string encoded;
+    put<uint32_t>(encoded, static_cast<uint32_t>(index.size()));
+    put<uint64_t>(encoded, amends);
+    for (const TileInfo &info : index)
+    {
+        put(encoded, info.col);
+        put(encoded, info.block);
+        put(encoded, info.offset);
+        put(encoded, info.length);
+        put(encoded, info.kind);
+    }
+    put<uint32_t>(encoded, spc::crc32(encoded.data(), encoded.size()));
+    return encoded;
+}
+
+std::vector<TileInfo> ColumnarFile::readIndex(const std::string &path, int &rows, int &cols)
+{
+    uint64_t indexOffset, indexBytes;
+    return readIndex(path, rows, cols, indexOffset, indexBytes);
+}
+
+std::vector<TileInfo> ColumnarFile::readIndex(const std::string &path, int &rows, int &cols, uint64_t &indexOffset, uint64_t &indexBytes)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("File error");
+
+    char headerBytes[HEADER_SIZE];
+    if (!file.read(headerBytes, HEADER_SIZE) || std::memcmp(headerBytes, MAGIC, 4) != 0)
+        throw std::runtime_error("Not a columnar sheet file.");
+
+    Reader header(headerBytes + 4, HEADER_SIZE - 4);
+    if (header.get<uint32_t>() != VERSION)
+        throw std::runtime_error("Unsupported columnar file version.");
+    indexOffset = header.get<uint64_t>();
+    rows = static_cast<int>(header.get<uint32_t>());
+    cols = static_cast<int>(header.get<uint32_t>());
+    if (header.get<uint32_t>() != TILE_ROWS || rows < 0 || cols < 0)
+        throw std::runtime_error("Columnar file is malformed.");
+
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    uint64_t blocks = (static_cast<uint64_t>(rows) + TILE_ROWS - 1) / TILE_ROWS;
+    uint64_t tileCount = blocks * static_cast<uint64_t>(cols);
+    if (tileCount > fileSize / INDEX_ENTRY_SIZE)
+        throw std::runtime_error("Columnar file is malformed.");
+
+    // The latest entry of a tile wins; amendments always lie after the index they amend.
+    std::vector<TileInfo> index(tileCount);
+    std::vector<bool> found(tileCount, false);
+    indexBytes = 0;
+    for (uint64_t at = indexOffset;;)
+    {
+        if (at < HEADER_SIZE || at > fileSize || fileSize - at < INDEX_HEADER_SIZE + 4)
+            throw std::runtime_error("Columnar file is truncated.");
+
+        char countBytes[INDEX_HEADER_SIZE];
+        file.seekg(at);
+        file.read(countBytes, INDEX_HEADER_SIZE);
+        uint32_t entries;
+        std::memcpy(&entries, countBytes, sizeof(entries));
+        if (entries > (fileSize - at - INDEX_HEADER_SIZE - 4) / INDEX_ENTRY_SIZE)
+            throw std::runtime_error("Columnar file is malformed.");
+
+        std::string bytes(INDEX_HEADER_SIZE + entries * INDEX_ENTRY_SIZE + 4, '\0');
+        file.seekg(at);
+        file.read(&bytes[0], bytes.size());
+        indexBytes += bytes.size();
+
+        Reader in(bytes.data(), bytes.size());
+        in.skip(sizeof(uint32_t));
+        uint64_t amends = in.get<uint64_t>();
+        for (uint32_t i = 0; i < entries; ++i)
+        {
+            TileInfo info;
+            info.col = in.get<uint32_t>();
+            info.block = in.get<uint32_t>();
+            info.offset = in.get<uint64_t>();
+            info.length = in.get<uint32_t>();
+            info.kind = in.get<uint8_t>();
+            if (info.col >= static_cast<uint64_t>(cols) || info.block >= blocks || info.offset + info.length > at)
+                throw std::runtime_error("Columnar file is malformed.");
+            size_t slot = static_cast<size_t>(info.col * blocks + info.block);
+            if (!found[slot])
+            {
+                index[slot] = info;
+                found[slot] = true;
+            }
+        }
+
+        size_t checked = bytes.size() - in.remaining();
+        if (in.get<uint32_t>() != spc::crc32(bytes.data(), checked))
+            throw std::runtime_error("Columnar file index is corrupted.");
+        if (amends == 0)
+            break;
+        if (amends >= at)
+            throw std::runtime_error("Columnar file is malformed.");
+        at = amends;
+    }
+
+    if (std::find(found.begin(), found.end(), false) != found.end())
+        throw std::runtime_error("Columnar file is malformed.");
+    return index;
+}
+
+std::string ColumnarFile::readTile(std::ifstream &file, const TileInfo &info) const
+{
+    std::string bytes(info.length, '\0');
+    file.seekg(info.offset);
+    if (!file.read(&bytes[0], bytes.size()))
+        throw std::runtime_error("Columnar file is truncated.");
+    return bytes;
+}
+
+bool ColumnarFile::update(const std::string &path, const Spreadsheet &sheet, const std::set<std::pair<int, int>> &tiles)
+{
+    int rows, cols;
+    uint64_t indexOffset, indexBytes;
+    std::vector<TileInfo> index;
+    try
+    {
+        index = readIndex(path, rows, cols, indexOffset, indexBytes);
+    }
+    catch (const std::runtime_error &)
+    {
+        return false;
+    }
+
+    int blocks = (rows + TILE_ROWS - 1) / TILE_ROWS;
+    if (rows != sheet.getRowCount() || cols != sheet.getColCount() ||
+        index.size() != static_cast<size_t>(blocks) * cols)
+        return false;
+    if (tiles.empty())
+        return true;
+
+    int fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0)
+        return false;
+    off_t end = ::lseek(fd, 0, SEEK_END);
+    if (end < 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // Tiles are stored column by column, so a tile's index entry sits at col * blocks + block.
+    std::string appended;
+    std::vector<TileInfo> changed;
+    uint64_t offset = static_cast<uint64_t>(end);
+    for (const auto &[block, col] : tiles)
+    {
+        if (block < 0 || block >= blocks || col < 0 || col >= cols)
+            continue;
+        TileInfo &info = index[static_cast<size_t>(col) * blocks + block];
+        std::string tile = encodeTile(sheet, col, block, info);
+        info.offset = offset + appended.size();
+        info.length = static_cast<uint32_t>(tile.size());
+        appended += tile;
+        changed.push_back(info);
+    }
+
+    // Only the changed entries are appended, until the amendments to the last full index would
+    // outgrow it; a full index replaces them then, and they count as dead space like superseded tiles.
+    uint64_t fullIndexSize = INDEX_HEADER_SIZE + index.size() * INDEX_ENTRY_SIZE + 4;
+    uint64_t amendmentSize = INDEX_HEADER_SIZE + changed.size() * INDEX_ENTRY_SIZE + 4;
+    bool amend = indexBytes + amendmentSize <= 2 * fullIndexSize;
+    std::string encodedIndex = amend ? encodeIndex(changed, indexOffset) : encodeIndex(index, 0);
+    uint64_t newIndexOffset = offset + appended.size();
+    appended += encodedIndex;
+
+    uint64_t live = HEADER_SIZE + (amend ? indexBytes + amendmentSize : fullIndexSize);
+    for (const TileInfo &info : index)
+        live += info.length;
+    uint64_t total = static_cast<uint64_t>(end) + appended.size();
+    if (static_cast<double>(total - live) > MAX_DEAD_FRACTION * total)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    bool ok = writeAt(fd, appended.data(), appended.size(), end) && ::fsync(fd) == 0 &&
+              writeAt(fd, reinterpret_cast<const char *>(&newIndexOffset), sizeof(newIndexOffset), 8) &&
+              ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok)
+        throw std::runtime_error("File could not be written.");
+    return true;
+}
+
+void ColumnarFile::read(const std::string &path, Spreadsheet &sheet)
+{
+    int rows, cols;
+    std::vector<TileInfo> index = readIndex(path, rows, cols);
+    rows = std::min(rows, static_cast<int>(Spreadsheet::MAX_ROWS));
+    cols = std::min(cols, static_cast<int>(Spreadsheet::MAX_COLS));
+    sheet.expand(std::max(rows, sheet.getRowCount()), std::max(cols, sheet.getColCount()));
+
+    std::ifstream file(path, std::ios::binary);
+    std::vector<std::pair<std::pair<int, int>, std::string>> formulas;
+
+    for (const TileInfo &info : index)
+    {
+        if (info.kind == TILE_EMPTY || static_cast<int>(info.col) >= cols)
+            continue;
+
+        std::string bytes = readTile(file, info);
+        std::vector<StoredCell> cells = decodeTile(bytes.data(), bytes.size());
+        int c = info.col;
+        for (size_t i = 0; i < cells.size(); ++i)
+        {
+            int r = info.block * TILE_ROWS + static_cast<int>(i);
+            if (r >= rows)
+                break;
+
+            const StoredCell &stored = cells[i];
+            switch (stored.type)
+            {
+            case StoredCell::INT:
+                sheet.setCell(r, c, std::make_unique<IntValueCell>(r, c, static_cast<int>(stored.intValue)));
+                break;
+            case StoredCell::DOUBLE:
+                sheet.setCell(r, c, std::make_unique<DoubleValueCell>(r, c, stored.doubleValue));
+                break;
+            case StoredCell::STRING:
+                sheet.setCell(r, c, std::make_unique<StringValueCell>(r, c, stored.text));
+                break;
+            case StoredCell::FORMULA:
+                formulas.push_back({{r, c}, stored.text});
+                break;
+            case StoredCell::EMPTY:
+                break;
+            }
+        }
+    }
+
+    // Formulas are entered once every value is in place, in row-major order like a CSV load.
+    std::sort(formulas.begin(), formulas.end());
+    for (auto &[pos, formula] : formulas)
+        sheet.enterData(pos.first, pos.second, formula);
+}
@@ -0,0 +1,171 @@
+#ifndef COLUMNAR_FILE_H
+#define COLUMNAR_FILE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <set>
+
+class Spreadsheet;
+
+/**
+ * @struct TileInfo
+ * @brief Index entry of one tile: a single column over TILE_ROWS consecutive rows.
+ */
+struct TileInfo
+{
+    uint32_t col = 0;      ///< Column of the tile.
+    uint32_t block = 0;    ///< Row block of the tile (first row is block * TILE_ROWS).
+    uint64_t offset = 0;   ///< Byte offset of the encoded tile in the file.
+    uint32_t length = 0;   ///< Length of the encoded tile in bytes.
+    uint8_t kind = 0;      ///< Encoding of the tile (empty, int, double or mixed).
+};
+
+/**
+ * @class ColumnarFile
+ * @brief Reads and writes spreadsheets in the compressed columnar ".scol" format.
+ *
+ * The sheet is cut into tiles of one column by TILE_ROWS rows. Numbers are scaled
+ * to integers by the fewest decimal digits that keep them exact, then delta encoded
+ * and bit packed. Tiles mixing types store a bit-packed type per cell, their numbers
+ * as above and their text and formulas in a dictionary with bit-packed indices.
+ *
+ * Layout: a fixed header (magic, version, index offset, dimensions), the tiles,
+ * then the index (entry count, offset of the index it amends, one TileInfo per
+ * tile, CRC-32). An incremental update appends the rewritten tiles and an index
+ * of just their entries, amending the previous one, and then points the header
+ * at it; once such amendments outgrow a full index, a full one is appended
+ * instead. The superseded bytes stay behind as dead space until the next full
+ * rewrite.
+ */
+class ColumnarFile
+{
+public:
+    /** @brief Number of rows in one tile. */
+    static constexpr int TILE_ROWS = 64;
+
+    /** @brief Fraction of dead bytes above which update() asks for a full rewrite. */
+    static constexpr double MAX_DEAD_FRACTION = 0.5;
+
+    /**
+     * @brief Checks whether a path names a columnar sheet file.
+     * @param path The file path.
+     * @return True if the path ends with ".scol".
+     */
+    static bool isColumnarPath(const std::string &path);
+
+    /**
+     * @brief Writes a spreadsheet to a columnar file.
+     * @param path The file to write.
+     * @param sheet The Spreadsheet to store.
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    void write(const std::string &path, const Spreadsheet &sheet);
+
+    /**
+     * @brief Reads a columnar file into a spreadsheet.
+     * @param path The file to read.
+     * @param sheet The Spreadsheet to populate.
+     * @throws std::runtime_error if the file is missing or malformed.
+     */
+    void read(const std::string &path, Spreadsheet &sheet);
+
+    /**
+     * @brief Rewrites only the given tiles of an existing columnar file.
+     *        The new tiles and index are appended and synced before the header is
+     *        pointed at them, so a crash leaves the previous version readable.
+     * @param path The file to update.
+     * @param sheet The Spreadsheet the file is a previous version of.
+     * @param tiles The changed tiles as (row block, column) pairs.
+     * @return False if the file has to be rewritten in full instead: it is missing or
+     *         unreadable, its dimensions differ from the sheet, or more than
+     *         MAX_DEAD_FRACTION of it would be dead space.
+     * @throws std::runtime_error if writing to the file fails.
+     */
+    bool update(const std::string &path, const Spreadsheet &sheet, const std::set<std::pair<int, int>> &tiles);
+
+    /**
+     * @brief Reads only the tile index of a columnar file.
+     * @param path The file to read.
+     * @param rows Receives the number of rows of the sheet.
+     * @param cols Receives the number of columns of the sheet.
+     * @return The index entries of all tiles.
+     */
+    std::vector<TileInfo> readIndex(const std::string &path, int &rows, int &cols);
+
+private:
+    /**
+     * @brief One cell as stored in a tile.
+     */
+    struct StoredCell
+    {
+        enum Type : uint8_t { EMPTY, INT, DOUBLE, STRING, FORMULA } type = EMPTY;
+        int64_t intValue = 0;    ///< Value of an INT cell.
+        double doubleValue = 0;  ///< Value of a DOUBLE cell.
+        std::string text;        ///< Text of a STRING cell or formula of a FORMULA cell.
+
+        bool operator==(const StoredCell &other) const
+        {
+            return type == other.type && intValue == other.intValue &&
+                   doubleValue == other.doubleValue && text == other.text;
+        }
+    };
+
+    /**
+     * @brief Converts a spreadsheet cell into its stored form.
+     * @param sheet The Spreadsheet to read.
+     * @param row The row of the cell.
+     * @param col The column of the cell.
+     * @return The stored form of the cell.
+     */
+    StoredCell storeCell(const Spreadsheet &sheet, int row, int col) const;
+
+    /**
+     * @brief Encodes one tile of a spreadsheet.
+     * @param sheet The Spreadsheet to read.
+     * @param col The column of the tile.
+     * @param block The row block of the tile.
+     * @param info Receives the kind of the tile.
+     * @return The encoded tile.
+     */
+    std::string encodeTile(const Spreadsheet &sheet, int col, int block, TileInfo &info) const;
+
+    /**
+     * @brief Decodes a tile.
+     * @param data The encoded bytes.
+     * @param length The number of encoded bytes.
+     * @return The cells of the tile, one per row.
+     */
+    std::vector<StoredCell> decodeTile(const char *data, size_t length) const;
+
+    /**
+     * @brief Reads the bytes of one tile from an open file.
+     * @param file The file stream.
+     * @param info The index entry of the tile.
+     * @return The encoded tile.
+     */
+    std::string readTile(std::ifstream &file, const TileInfo &info) const;
+
+    /**
+     * @brief Reads the tile index of a columnar file along with its position, following
+     *        the amendments from the latest back to the last full index.
+     * @param path The file to read.
+     * @param rows Receives the number of rows of the sheet.
+     * @param cols Receives the number of columns of the sheet.
+     * @param indexOffset Receives the byte offset of the latest index.
+     * @param indexBytes Receives the size of the indexes read, amendments and full index.
+     * @return The index entries of all tiles, column by column.
+     */
+    std::vector<TileInfo> readIndex(const std::string &path, int &rows, int &cols, uint64_t &indexOffset, uint64_t &indexBytes);
+
+    /**
+     * @brief Encodes a tile index, followed by its CRC-32.
+     * @param index The index entries.
+     * @param amends The offset of the index this one amends, or 0 for a full index.
+     * @return The encoded index.
+     */
+    std::string encodeIndex(const std::vector<TileInfo> &index, uint64_t amends) const;
+};
+
+#endif
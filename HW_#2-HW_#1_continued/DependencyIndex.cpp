@@ -0,0 +1,104 @@
+#include "DependencyIndex.h"
+#include "Spreadsheet.h"
+#include <algorithm>
+
+static_assert(Spreadsheet::MAX_ROWS <= (1 << 17), "DependencyIndex::ROW_LEAVES must cover every row");
+static_assert(Spreadsheet::MAX_COLS <= (1 << 10), "DependencyIndex::COL_LEAVES must cover every column");
+
+namespace
+{
+    /**
+     * @brief Calls out with the nodes of a segment tree with the given number of leaves
+     *        that exactly cover [low, high].
+     */
+    template <typename Out>
+    void coveringNodes(uint32_t leaves, int low, int high, Out out)
+    {
+        uint32_t lo = leaves + static_cast<uint32_t>(low);
+        uint32_t hi = leaves + static_cast<uint32_t>(high) + 1;
+        for (; lo < hi; lo >>= 1, hi >>= 1)
+        {
+            if (lo & 1)
+                out(lo++);
+            if (hi & 1)
+                out(--hi);
+        }
+    }
+
+    bool sameRanges(const spc::smallvec<CellRect, 2> &a, const spc::smallvec<CellRect, 2> &b)
+    {
+        if (a.size() != b.size())
+            return false;
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            if (a[i].top != b[i].top || a[i].left != b[i].left || a[i].bottom != b[i].bottom || a[i].right != b[i].right)
+                return false;
+        }
+        return true;
+    }
+}
+
+void DependencyIndex::assign(std::pair<int, int> formula, const spc::smallvec<CellRect, 2> &ranges)
+{
+    auto it = formulas.find(formula);
+    if (it != formulas.end())
+    {
+        if (sameRanges(it->second.ranges, ranges))
+            return;
+        remove(formula);
+    }
+
+    Registration registration{nextGeneration++, 0, ranges};
+    registration.entries = insertEntries(formula, registration);
+    liveEntries += registration.entries;
+    formulas.emplace(formula, std::move(registration));
+}
+
+void DependencyIndex::remove(std::pair<int, int> formula)
+{
+    auto it = formulas.find(formula);
+    if (it == formulas.end())
+        return;
+
+    liveEntries -= it->second.entries;
+    staleEntries += it->second.entries;
+    formulas.erase(it);
+
+    if (staleEntries > liveEntries + MIN_STALE_BEFORE_REBUILD)
+        rebuild();
+}
+
+size_t DependencyIndex::insertEntries(std::pair<int, int> formula, const Registration &registration)
+{
+    size_t added = 0;
+    Entry entry{formula.first, formula.second, registration.generation};
+    for (const CellRect &rect : registration.ranges)
+    {
+        // Parts of a range beyond the grid can never change, so they need no entries.
+        int top = std::max(rect.top, 0);
+        int left = std::max(rect.left, 0);
+        int bottom = std::min(rect.bottom, static_cast<int>(ROW_LEAVES) - 1);
+        int right = std::min(rect.right, static_cast<int>(COL_LEAVES) - 1);
+        if (top > bottom || left > right)
+            continue;
+
+        coveringNodes(ROW_LEAVES, top, bottom, [&](uint32_t rowNode) {
+            coveringNodes(COL_LEAVES, left, right, [&](uint32_t colNode) {
+                buckets[key(rowNode, colNode)].push_back(entry);
+                ++rowNodes[rowNode];
+                ++added;
+            });
+        });
+    }
+    return added;
+}
+
+void DependencyIndex::rebuild()
+{
+    buckets.clear();
+    rowNodes.clear();
+    liveEntries = 0;
+    staleEntries = 0;
+    for (const auto &[formula, registration] : formulas)
+        liveEntries += insertEntries(formula, registration);
+}
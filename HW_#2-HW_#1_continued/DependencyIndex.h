@@ -0,0 +1,134 @@
+#ifndef DEPENDENCY_INDEX_H
+#define DEPENDENCY_INDEX_H
+
+#include "Cell.h"
+#include "smallvec.h"
+#include "myset.h"
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @class DependencyIndex
+ * @brief Answers "which formula cells read this cell" without scanning the sheet.
+ *
+ * Every formula registers the rectangles it reads. The index is a sparse
+ * two-dimensional segment tree: a rectangle is stored in the O(log rows x log cols)
+ * nodes that exactly cover it, and a cell is looked up by visiting the nodes on its
+ * path from the root. Memory and lookup time therefore grow with the number of
+ * formulas, not with the size of their ranges: SUM(A1..A100000) takes at most a
+ * few dozen entries.
+ *
+ * Re-registering or removing a formula only invalidates its old entries; they are
+ * skipped by lookups and dropped once they outnumber the live ones.
+ */
+class DependencyIndex
+{
+public:
+    /**
+     * @brief Registers the rectangles a formula cell reads, replacing any earlier registration.
+     *        Does nothing if they are unchanged, which is the common case after a recalculation.
+     * @param formula The (row, column) of the formula cell.
+     * @param ranges The rectangles it reads.
+     */
+    void assign(std::pair<int, int> formula, const spc::smallvec<CellRect, 2> &ranges);
+
+    /**
+     * @brief Forgets a formula cell, e.g. because it was overwritten.
+     * @param formula The (row, column) of the cell; unknown cells are ignored.
+     */
+    void remove(std::pair<int, int> formula);
+
+    /**
+     * @brief Calls a function for every formula cell that reads a cell. A formula is
+     *        reported once for each of its rectangles that contains the cell.
+     * @param cell The (row, column) of the cell.
+     * @param visit Called with the (row, column) of each reading formula.
+     */
+    template <typename Visit>
+    void forEachReader(std::pair<int, int> cell, Visit visit) const
+    {
+        if (cell.first < 0 || cell.first >= static_cast<int>(ROW_LEAVES) || cell.second < 0 || cell.second >= static_cast<int>(COL_LEAVES))
+            return;
+
+        for (uint32_t rowNode = ROW_LEAVES + cell.first; rowNode >= 1; rowNode >>= 1)
+        {
+            if (!rowNodes.count(rowNode))
+                continue;
+            for (uint32_t colNode = COL_LEAVES + cell.second; colNode >= 1; colNode >>= 1)
+            {
+                auto bucket = buckets.find(key(rowNode, colNode));
+                if (bucket == buckets.end())
+                    continue;
+                for (const Entry &entry : bucket->second)
+                    if (isLive(entry))
+                        visit(std::pair<int, int>(entry.row, entry.col));
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the number of registered formula cells.
+     * @return The number of formulas in the index.
+     */
+    size_t size() const { return formulas.size(); }
+
+private:
+    /** @brief Leaves of the row tree; at least Spreadsheet::MAX_ROWS. */
+    static constexpr uint32_t ROW_LEAVES = 1u << 17;
+
+    /** @brief Leaves of the column tree; at least Spreadsheet::MAX_COLS. */
+    static constexpr uint32_t COL_LEAVES = 1u << 10;
+
+    /** @brief Stale entries tolerated beyond the live ones before the index is rebuilt. */
+    static constexpr size_t MIN_STALE_BEFORE_REBUILD = 1024;
+
+    /**
+     * @brief One formula stored in a node.
+     */
+    struct Entry
+    {
+        int row;              ///< Row of the formula cell.
+        int col;              ///< Column of the formula cell.
+        uint32_t generation;  ///< Registration the entry belongs to; older ones are stale.
+    };
+
+    /**
+     * @brief The current registration of a formula cell.
+     */
+    struct Registration
+    {
+        uint32_t generation;                ///< Matches the generation of its live entries.
+        size_t entries;                     ///< Number of node entries it occupies.
+        spc::smallvec<CellRect, 2> ranges;  ///< The rectangles it reads.
+    };
+
+    std::unordered_map<uint64_t, std::vector<Entry>> buckets;  ///< Entries per (row node, column node).
+    std::unordered_map<uint32_t, size_t> rowNodes;             ///< Entries per row node, to skip empty ones.
+    std::unordered_map<std::pair<int, int>, Registration, spc::hash<std::pair<int, int>>> formulas;
+    uint32_t nextGeneration = 1;  ///< Generation given to the next registration.
+    size_t liveEntries = 0;       ///< Entries belonging to current registrations.
+    size_t staleEntries = 0;      ///< Entries left behind by replaced or removed registrations.
+
+    static uint64_t key(uint32_t rowNode, uint32_t colNode) { return (static_cast<uint64_t>(rowNode) << 32) | colNode; }
+
+    bool isLive(const Entry &entry) const
+    {
+        auto it = formulas.find({entry.row, entry.col});
+        return it != formulas.end() && it->second.generation == entry.generation;
+    }
+
+    /**
+     * @brief Adds the entries of a registration to the nodes covering its rectangles.
+     * @return The number of entries added.
+     */
+    size_t insertEntries(std::pair<int, int> formula, const Registration &registration);
+
+    /**
+     * @brief Drops every stale entry by rebuilding the nodes from the registrations.
+     */
+    void rebuild();
+};
+
+#endif
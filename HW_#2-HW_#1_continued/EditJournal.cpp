@@ -0,0 +1,184 @@
+#include "EditJournal.h"
+#include "Spreadsheet.h"
+#include "Checksum.h"
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>    // For open()
+#include <unistd.h>   // For read(), write(), fsync(), ftruncate()
+#include <sys/stat.h>
+
+namespace
+{
+    const char MAGIC[4] = {'S', 'P', 'W', 'L'};
+    const uint32_t VERSION = 1;
+    const size_t FILE_HEADER_SIZE = 8;    // magic + version
+    const size_t RECORD_HEADER_SIZE = 16; // length + crc + row + col
+    const uint32_t MAX_PAYLOAD = 1 << 20;
+
+    void putU32(std::string &out, uint32_t v)
+    {
+        char buf[4];
+        std::memcpy(buf, &v, 4);
+        out.append(buf, 4);
+    }
+
+    uint32_t getU32(const char *p)
+    {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return v;
+    }
+}
+
+EditJournal::EditJournal(const std::string &p)
+    : path(p), fd(-1), pendingRecords(0), recordCount(0)
+{
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Journal could not open: " + path);
+
+    // A header torn by a crash right after creation is treated like an empty journal.
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size < static_cast<off_t>(FILE_HEADER_SIZE))
+        writeHeader();
+}
+
+EditJournal::~EditJournal()
+{
+    try
+    {
+        commit();
+    }
+    catch (const std::exception &)
+    {
+        // Nothing sensible left to do while tearing down.
+    }
+    if (fd >= 0)
+        ::close(fd);
+}
+
+void EditJournal::append(int row, int col, const std::string &input)
+{
+    std::string body;
+    putU32(body, static_cast<uint32_t>(row));
+    putU32(body, static_cast<uint32_t>(col));
+    body += input;
+
+    if (pendingRecords == 0)
+        firstPending = std::chrono::steady_clock::now();
+
+    putU32(pending, static_cast<uint32_t>(input.size()));
+    putU32(pending, spc::crc32(body.data(), body.size()));
+    pending += body;
+    ++pendingRecords;
+    ++recordCount;
+
+    auto waited = std::chrono::steady_clock::now() - firstPending;
+    if (pendingRecords >= GROUP_COMMIT_RECORDS ||
+        waited >= std::chrono::milliseconds(GROUP_COMMIT_MILLIS))
+        commit();
+}
+
+void EditJournal::commit()
+{
+    if (pending.empty())
+        return;
+
+    ::lseek(fd, 0, SEEK_END);
+    writeAll(pending.data(), pending.size());
+    if (fsync(fd) != 0)
+        throw std::runtime_error("Journal could not be synced: " + path);
+
+    pending.clear();
+    pendingRecords = 0;
+}
+
+int EditJournal::replay(Spreadsheet &sheet)
+{
+    commit();
+
+    std::string contents;
+    char buf[65536];
+    ::lseek(fd, 0, SEEK_SET);
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0)
+        contents.append(buf, n);
+
+    if (contents.size() < FILE_HEADER_SIZE)
+    {
+        writeHeader();
+        recordCount = 0;
+        return 0;
+    }
+    if (std::memcmp(contents.data(), MAGIC, 4) != 0 || getU32(contents.data() + 4) != VERSION)
+        throw std::runtime_error("Not a journal file: " + path);
+
+    size_t offset = FILE_HEADER_SIZE;
+    int applied = 0;
+
+    while (offset + RECORD_HEADER_SIZE <= contents.size())
+    {
+        const char *rec = contents.data() + offset;
+        uint32_t length = getU32(rec);
+        if (length > MAX_PAYLOAD || offset + RECORD_HEADER_SIZE + length > contents.size())
+            break; // torn write at the tail
+
+        if (spc::crc32(rec + 8, length + 8) != getU32(rec + 4))
+            break; // corrupted record, nothing after it can be trusted
+
+        int row = static_cast<int>(getU32(rec + 8));
+        int col = static_cast<int>(getU32(rec + 12));
+        if (row < 0 || col < 0 || row >= Spreadsheet::MAX_ROWS || col >= Spreadsheet::MAX_COLS)
+            break;
+
+        sheet.commitEdit(row, col, std::string(rec + RECORD_HEADER_SIZE, length));
+        offset += RECORD_HEADER_SIZE + length;
+        ++applied;
+    }
+
+    if (offset != contents.size())
+    {
+        if (ftruncate(fd, offset) != 0)
+            throw std::runtime_error("Journal tail could not be truncated: " + path);
+        fsync(fd);
+    }
+
+    recordCount = applied;
+    return applied;
+}
+
+void EditJournal::truncate()
+{
+    pending.clear();
+    pendingRecords = 0;
+    recordCount = 0;
+
+    if (ftruncate(fd, FILE_HEADER_SIZE) != 0)
+        throw std::runtime_error("Journal could not be truncated: " + path);
+    fsync(fd);
+}
+
+void EditJournal::writeHeader()
+{
+    if (ftruncate(fd, 0) != 0)
+        throw std::runtime_error("Journal could not be reset: " + path);
+
+    std::string header(MAGIC, 4);
+    putU32(header, VERSION);
+    ::lseek(fd, 0, SEEK_SET);
+    writeAll(header.data(), header.size());
+    if (fsync(fd) != 0)
+        throw std::runtime_error("Journal could not be synced: " + path);
+}
+
+void EditJournal::writeAll(const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t written = ::write(fd, data, len);
+        if (written < 0)
+            throw std::runtime_error("Journal write failed: " + path);
+        data += written;
+        len -= written;
+    }
+}
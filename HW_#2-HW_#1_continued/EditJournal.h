@@ -0,0 +1,109 @@
+#ifndef EDIT_JOURNAL_H
+#define EDIT_JOURNAL_H
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+class Spreadsheet;
+
+/**
+ * @class EditJournal
+ * @brief An append-only write-ahead log of committed cell edits for one spreadsheet.
+ *
+ * Every edit is stored as a binary record (row, column, raw input) protected by a
+ * CRC-32 checksum. Records are buffered and written with a single write + fsync once
+ * enough of them are pending, when a new record finds the oldest one waited long
+ * enough, or when the owner calls commit() before going idle (group commit).
+ * On open the journal is replayed on top of the last snapshot; a torn or corrupted
+ * tail is detected by its checksum and cut off.
+ */
+class EditJournal
+{
+public:
+    /** @brief Number of buffered records that forces a group commit. */
+    static constexpr int GROUP_COMMIT_RECORDS = 32;
+
+    /** @brief Maximum time in milliseconds a record may wait in the buffer. */
+    static constexpr int GROUP_COMMIT_MILLIS = 50;
+
+    /** @brief Record count after which the journal should be folded into a snapshot. */
+    static constexpr int COMPACT_THRESHOLD = 1024;
+
+    /**
+     * @brief Opens (or creates) the journal file at the given path.
+     * @param path The path of the journal file.
+     * @throws std::runtime_error if the file cannot be opened or has a foreign header.
+     */
+    explicit EditJournal(const std::string &path);
+
+    /**
+     * @brief Destructor: commits pending records and closes the file.
+     */
+    ~EditJournal();
+
+    EditJournal(const EditJournal &) = delete;
+    EditJournal &operator=(const EditJournal &) = delete;
+
+    /**
+     * @brief Appends an edit to the journal.
+     * @param row The row index of the edited cell.
+     * @param col The column index of the edited cell.
+     * @param input The raw input that was entered into the cell.
+     */
+    void append(int row, int col, const std::string &input);
+
+    /**
+     * @brief Writes all buffered records and syncs them to disk.
+     */
+    void commit();
+
+    /**
+     * @brief Applies every valid record in the journal to a spreadsheet.
+     *        A corrupted or incomplete tail is truncated away.
+     * @param sheet The Spreadsheet to replay the edits on.
+     * @return The number of records applied.
+     */
+    int replay(Spreadsheet &sheet);
+
+    /**
+     * @brief Discards all records, typically after a full snapshot has been saved.
+     */
+    void truncate();
+
+    /**
+     * @brief Returns the number of records currently stored in the journal.
+     * @return The record count, including buffered records.
+     */
+    int getRecordCount() const { return recordCount; }
+
+    /**
+     * @brief Checks whether the journal has grown enough to be compacted.
+     * @return True if the record count reached COMPACT_THRESHOLD.
+     */
+    bool needsCompaction() const { return recordCount >= COMPACT_THRESHOLD; }
+
+private:
+    std::string path;        ///< Path of the journal file.
+    int fd;                  ///< File descriptor of the open journal.
+    std::string pending;     ///< Encoded records waiting for the next group commit.
+    int pendingRecords;      ///< Number of records in the pending buffer.
+    int recordCount;         ///< Number of records in the journal.
+    std::chrono::steady_clock::time_point firstPending; ///< Time the oldest pending record was appended.
+
+    /**
+     * @brief Empties the file and writes a fresh header to it.
+     * @throws std::runtime_error on write failure.
+     */
+    void writeHeader();
+
+    /**
+     * @brief Writes a whole buffer to the journal file, retrying short writes.
+     * @param data Pointer to the bytes to write.
+     * @param len Number of bytes.
+     * @throws std::runtime_error on write failure.
+     */
+    void writeAll(const char *data, size_t len);
+};
+
+#endif
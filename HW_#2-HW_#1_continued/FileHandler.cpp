@@ -1,36 +1,98 @@
 #include <string>
 #include <fstream>
 #include <stdexcept>
+#include <cstdio>     // For std::rename()
+#include <fcntl.h>    // For open()
+#include <unistd.h>   // For fsync()
 #include "FileHandler.h"
 #include "Cell.h"
+#include "ColumnarFile.h"
 
 void FileHandler::saveToFile(const std::string &filename, const Spreadsheet &sheet)
 {
-    std::ofstream file(filename);
+    // Written next to the target and renamed over it, so a crash never leaves a torn sheet.
+    const std::string tempName = filename + ".tmp";
+    if (ColumnarFile::isColumnarPath(filename))
+    {
+        ColumnarFile().write(tempName, sheet);
+        replaceDurably(tempName, filename);
+        return;
+    }
+
+    std::ofstream file(tempName);
     if (!file.is_open())
         throw std::runtime_error("File could not open.");
+    writeCsv(file, sheet);
+    file.close();
+    if (file.fail())
+        throw std::runtime_error("File could not be written.");
+
+    replaceDurably(tempName, filename);
+}
 
+void FileHandler::writeCsv(std::ostream &out, const Spreadsheet &sheet)
+{
     for (int i = 0; i < sheet.getRowCount(); ++i)
     {
         for (int j = 0; j < sheet.getColCount(); ++j)
         {
             Cell *cell = sheet.getCell(i, j);
             if (auto *formulaCell = dynamic_cast<FormulaCell *>(cell))
-                file << formulaCell->getFormula();
+                out << formulaCell->getFormula();
             else
-                file << cell->getValueAsString();
+                out << cell->getValueAsString();
             if (j < sheet.getColCount() - 1)
             {
-                file << ",";
+                out << ",";
             }
         }
-        file << "\n";
+        out << "\n";
     }
-    file.close();
+}
+
+void FileHandler::saveChanges(const std::string &filename, Spreadsheet &sheet)
+{
+    bool updated = ColumnarFile::isColumnarPath(filename) && !sheet.isFullyDirty() &&
+                   ColumnarFile().update(filename, sheet, sheet.getDirtyTiles());
+    if (!updated)
+        saveToFile(filename, sheet);
+    sheet.markClean();
+}
+
+void FileHandler::syncPath(const std::string &path, int flags)
+{
+    int fd = ::open(path.c_str(), flags);
+    if (fd < 0)
+        throw std::runtime_error("File could not open for syncing: " + path);
+    int result = fsync(fd);
+    ::close(fd);
+    if (result != 0)
+        throw std::runtime_error("File could not be synced: " + path);
+}
+
+void FileHandler::replaceDurably(const std::string &tempName, const std::string &filename)
+{
+    syncPath(tempName, O_RDONLY);
+
+    if (std::rename(tempName.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(tempName.c_str());
+        throw std::runtime_error("File could not be replaced: " + filename);
+    }
+
+    std::string::size_type slash = filename.find_last_of('/');
+    syncPath(slash == std::string::npos ? "." : filename.substr(0, slash), O_RDONLY | O_DIRECTORY);
 }
 
 void FileHandler::loadFromFile(const std::string &filename, Spreadsheet &spreadsheet)
 {
+    if (ColumnarFile::isColumnarPath(filename))
+    {
+        ColumnarFile().read(filename, spreadsheet);
+        spreadsheet.markClean();
+        return;
+    }
+
     std::ifstream file(filename);
     if (!file.is_open())
         throw std::runtime_error("File error");
@@ -59,4 +121,5 @@ void FileHandler::loadFromFile(const std::string &filename, Spreadsheet &spreads
         ++row;
     }
     file.close();
+    spreadsheet.markClean();
 }
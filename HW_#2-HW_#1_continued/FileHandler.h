@@ -1,6 +1,7 @@
 #ifndef HANDLE_EM
 #define HANDLE_EM
 
+#include <ostream>
 #include <string>
 #include "Spreadsheet.h"
 
@@ -15,19 +16,53 @@ class FileHandler
 public:
     /**
      * @brief Saves the current state of the spreadsheet to a file.
+     *        The data is written to a temporary file, synced and renamed over the
+     *        target, so the file on disk is always either the old or the new sheet.
+     *        Files ending in ".scol" are written in the columnar format (see ColumnarFile),
+     *        all others as CSV.
      * @param filename The name of the file to save to.
      * @param spreadsheet The Spreadsheet object to save.
      */
     void saveToFile(const std::string &filename, const Spreadsheet &spreadsheet);
 
     /**
-     * @brief Loads the state of the spreadsheet from a file.
+     * @brief Writes the spreadsheet as CSV: formulas as typed, other cells by value.
+     * @param out The stream to write to.
+     * @param spreadsheet The Spreadsheet object to write.
+     */
+    void writeCsv(std::ostream &out, const Spreadsheet &spreadsheet);
+
+    /**
+     * @brief Saves the edits made since the spreadsheet was last loaded from or saved to the file.
+     *        A columnar file only gets its changed tiles rewritten; any other file, and a
+     *        columnar file that is too fragmented, is saved in full with saveToFile.
+     * @param filename The name of the file the spreadsheet was loaded from or saved to.
+     * @param spreadsheet The Spreadsheet object to save; marked clean afterwards.
+     */
+    void saveChanges(const std::string &filename, Spreadsheet &spreadsheet);
+
+    /**
+     * @brief Loads the state of the spreadsheet from a file, CSV or columnar by extension.
      * @param filename The name of the file to load from.
      * @param spreadsheet The Spreadsheet object to populate.
      */
     void loadFromFile(const std::string &filename, Spreadsheet &spreadsheet);
 
 private:
+    /**
+     * @brief Opens a file or directory and syncs it to disk.
+     * @param path The path to sync.
+     * @param flags The flags passed to open().
+     */
+    void syncPath(const std::string& path, int flags);
+
+    /**
+     * @brief Syncs a temporary file, renames it over the target and syncs the directory.
+     * @param tempName The fully written temporary file.
+     * @param filename The file to replace.
+     */
+    void replaceDurably(const std::string& tempName, const std::string& filename);
+
     /**
      * @brief Checks if a given string represents an integer value.
      * @param str The string to check.
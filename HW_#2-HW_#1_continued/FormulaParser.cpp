@@ -5,74 +5,74 @@
 #include <stdexcept>
 #include <algorithm>
 #include <set>
+#include <map>
 #include <cmath>
+#include <limits>
 #include <memory>
 #include <iostream>
 #include "myset.h"
 #include "myvec.h"
+#include "smallvec.h"
 
-// From GPT-------------------------
-//----------------------------------
-std::string removeSpaces(const std::string &str)
+FormulaValue FormulaParser::parseAndEvaluate(std::string &formula, std::pair<int, int> coordinates, spc::myvec<std::pair<int, int>> &dependentCells)
 {
-    std::string newStr = str;
-    newStr.erase(remove(newStr.begin(), newStr.end(), ' '), newStr.end());
-    return newStr;
+    if (formula.empty())
+        return CellError::VALUE;
+    return evaluate(*compile(formula, coordinates), coordinates, dependentCells);
 }
 
-bool FormulaParser::isValue(const std::string &token) const
+std::shared_ptr<const FormulaTemplate> FormulaParser::compile(const std::string &formula, std::pair<int, int> coordinates)
 {
-    if (token.empty())
-        return false;
-
-    // Check if it's a pure number (no letters or invalid characters)
-    bool decimalPointSeen = false;
-    for (char c : token)
+    // Most formulas are copies of one compiled before, e.g. filled down a column: look first.
+    templateKey(formula, coordinates.first, coordinates.second, key);
+    ++stats.templateLookups;
+    auto found = templates.find(key);
+    if (found != templates.end())
     {
-        if (!isdigit(c))
+        if (auto shared = found->second.lock())
         {
-            if (c == '.' && !decimalPointSeen)
-            {
-                decimalPointSeen = true; // First decimal point is allowed
-            }
-            else
-            {
-                return false; // Invalid character
-            }
+            ++stats.templateHits;
+            return shared;
         }
     }
 
-    return true;
-}
-//----------------------------------
-//----------------------------------
-
-double FormulaParser::parseAndEvaluate(std::string &formula, std::pair<int, int> coordinates, spc::myvec<std::pair<int, int>> &dependentCells)
-{
-    if (formula.empty())
-        throw std::runtime_error("Empty formula input.\n");
+    FormulaTemplate compiled = compileTemplate(formula, coordinates.first, coordinates.second);
+    if (compiled.program.code.size() == 1 && compiled.program.code[0].op == OpCode::ERROR)
+    {
+        // Its template keeps the text as entered; the '!' keeps it apart from the keys of valid formulas.
+        key.assign("!").append(formula);
+        if (auto shared = templates[key].lock())
+            return shared;
+    }
 
-    spc::myvec<std::string> tokens = parsePlusAndMinus(formula.substr(1));
+    auto &entry = templates[key];
+    auto shared = std::make_shared<const FormulaTemplate>(std::move(compiled));
+    entry = shared;
 
-    if (tokens.empty())
-        throw std::runtime_error("Empty tokens at parseAndEvaluate.\n");
+    // Templates die with the last cell holding them; drop their entries now and then.
+    if (templates.size() > 2 * templatesAfterPurge + MIN_EXPIRED_BEFORE_PURGE)
+    {
+        for (auto it = templates.begin(); it != templates.end();)
+            it = it->second.expired() ? templates.erase(it) : std::next(it);
+        templatesAfterPurge = templates.size();
+    }
+    return shared;
+}
 
+FormulaValue FormulaParser::evaluate(const FormulaTemplate &formula, std::pair<int, int> coordinates, spc::myvec<std::pair<int, int>> &dependentCells)
+{
+    ++stats.evaluations;
     spc::myset<std::pair<int, int>> uniqueDependents;
-
-    bool isAddition = true;
-    double result = 0.0;
-
-    for (auto &token : tokens)
+    FormulaValue result = execute(formula.program, coordinates, uniqueDependents);
+    // Evaluation stops at the first error, but the cells it did not get to decide the value
+    // once the error is gone: the formula has to be recalculated when they change, too.
+    if (result.isError())
     {
-        if (token == "+")
-            isAddition = true;
-        else if (token == "-")
-            isAddition = false;
-        else
-        {
-            double tokenResult = evaluateMultpAndDivToken(token, uniqueDependents);
-            result = isAddition == true ? result + tokenResult : result - tokenResult;
-        }
+        recordReferences(formula.program, coordinates, uniqueDependents);
+        // A fresh cell never reads a stale one, or marking stale would stop short of it.
+        if (lazy)
+            for (const auto &dependent : uniqueDependents)
+                refresh(dependent);
     }
 
     for (const auto &dependent : uniqueDependents)
@@ -81,352 +81,815 @@ double FormulaParser::parseAndEvaluate(std::string &formula, std::pair<int, int>
     return result;
 }
 
-double FormulaParser::evaluateMultpAndDivToken(std::string &token, spc::myset<std::pair<int, int>> &uniqueDependents) const
+FormulaValue FormulaParser::execute(const FormulaProgram &program, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents)
 {
-    spc::myvec<std::string> tokens = parseMultpAndDiv(token);
-
-    double result = evaluateSingleToken(tokens[0], uniqueDependents);
-
-    bool isMultp = true;
-
-    for (int i = 1; i < tokens.get_size(); ++i)
+    // Every operator passes errors on, so the first one is the result and nothing on
+    // the stack is ever an error.
+    spc::smallvec<Operand, 16> stack;
+    for (const Instruction &instruction : program.code)
     {
-        if (tokens[i] == "*")
-            isMultp = true;
-        else if (tokens[i] == "/")
-            isMultp = false;
-        else
+        switch (instruction.op)
         {
-            double nextVal = evaluateSingleToken(tokens[i], uniqueDependents);
-            if (nextVal == 0.0 && isMultp == false) // divide 0 check
-                nextVal = 1;
-            result = isMultp ? result * nextVal : result / nextVal;
+        case OpCode::NUMBER:
+            stack.push_back({instruction.number, nullptr});
+            break;
+        case OpCode::CELL:
+        {
+            int row = instruction.absRow ? instruction.row : origin.first + instruction.row;
+            int col = instruction.absCol ? instruction.col : origin.second + instruction.col;
+            FormulaValue value = readReference(row, col, uniqueDependents);
+            if (value.isError())
+                return value;
+            stack.push_back({value.number, nullptr});
+            break;
         }
-    }
-    return result;
-}
-
-spc::myvec<std::string> FormulaParser::parseMultpAndDiv(const std::string &token) const
-{
-    spc::myvec<std::string> tokens;
-    std::string subToken;
-    for (size_t i = 0; i < token.size(); i++)
-    {
-        switch (token[i])
+        case OpCode::RANGE:
+            stack.push_back({0.0, &instruction});
+            break;
+        case OpCode::NEG:
+            stack.back().number = -stack.back().number;
+            break;
+        case OpCode::CALL:
         {
-        case '/':
-        case '*':
-            if (!subToken.empty())
-                tokens.push_back(subToken);
-
-            // string(1, formula[i]) creates a string with length one, simply convert char to string
-            tokens.push_back(std::string(1, token[i]));
-            subToken.clear();
+            const Operand *args = stack.end() - instruction.argc;
+            FormulaValue value = callFunction(instruction.function, args, instruction.argc, origin, uniqueDependents);
+            if (value.isError())
+                return value;
+            for (int i = 0; i < instruction.argc; ++i)
+                stack.pop_back();
+            stack.push_back({value.number, nullptr});
             break;
+        }
+        case OpCode::ERROR:
+            return instruction.error;
         default:
-            subToken += token[i];
+        {
+            double b = stack.back().number;
+            stack.pop_back();
+            double &a = stack.back().number;
+            switch (instruction.op)
+            {
+            case OpCode::ADD: a = a + b; break;
+            case OpCode::SUB: a = a - b; break;
+            case OpCode::MUL: a = a * b; break;
+            case OpCode::DIV:
+                if (b == 0.0)
+                    return CellError::DIV0;
+                a = a / b;
+                break;
+            case OpCode::EQ: a = a == b; break;
+            case OpCode::NE: a = a != b; break;
+            case OpCode::LT: a = a < b; break;
+            case OpCode::LE: a = a <= b; break;
+            case OpCode::GT: a = a > b; break;
+            case OpCode::GE: a = a >= b; break;
+            default: break;
+            }
             break;
         }
+        }
     }
-    if (token.empty())
-        throw std::invalid_argument("Not a valid formula there is a / or * sign at the end"); // throws to ParseAndEvaluate
-
-    tokens.push_back(subToken);
-    return tokens;
+    return stack.back().number + 0.0; // Turns -0 into 0, which would show as "-0"
 }
 
-spc::myvec<std::string> FormulaParser::parsePlusAndMinus(const std::string &formula) const
+void FormulaParser::recordReferences(const FormulaProgram &program, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents) const
 {
-    spc::myvec<std::string> tokens;
-    std::string token;
-    for (size_t i = 0; i < formula.size(); i++)
+    // The cells of a range depend on the function it is passed to, so the operand stack is
+    // followed just far enough to tell which call takes each range.
+    spc::smallvec<const Instruction *, 16> stack;
+    for (const Instruction &instruction : program.code)
     {
-        switch (formula[i])
+        switch (instruction.op)
+        {
+        case OpCode::NUMBER:
+            stack.push_back(nullptr);
+            break;
+        case OpCode::CELL:
         {
-        case '+':
-        case '-':
-            if (!token.empty())
-                tokens.push_back(token);
-
-            // string(1, formula[i]) creates a string with length one, simply convert char to string
-            tokens.push_back(std::string(1, formula[i]));
-            token.clear();
+            int row = instruction.absRow ? instruction.row : origin.first + instruction.row;
+            int col = instruction.absCol ? instruction.col : origin.second + instruction.col;
+            if (withinLimits(row, col))
+                uniqueDependents.insert({row, col});
+            stack.push_back(nullptr);
             break;
-        case ' ':
+        }
+        case OpCode::RANGE:
+            stack.push_back(&instruction);
+            break;
+        case OpCode::NEG:
+            break;
+        case OpCode::CALL:
+        {
+            for (int i = instruction.argc; i > 0; --i)
+            {
+                const Instruction *range = stack[stack.size() - i];
+                if (!range)
+                    continue;
+                int firstRow = range->absRow ? range->row : origin.first + range->row;
+                int firstCol = range->absCol ? range->col : origin.second + range->col;
+                int lastRow = range->endAbsRow ? range->endRow : origin.first + range->endRow;
+                int lastCol = range->endAbsCol ? range->endCol : origin.second + range->endCol;
+                if (!withinLimits(firstRow, firstCol) || !withinLimits(lastRow, lastCol))
+                    continue;
+                forEachRangeCell(instruction.function, firstRow, firstCol, lastRow, lastCol, [&](int row, int col) {
+                    uniqueDependents.insert({row, col});
+                    return true;
+                });
+            }
+            for (int i = 0; i < instruction.argc; ++i)
+                stack.pop_back();
+            stack.push_back(nullptr);
             break;
+        }
+        case OpCode::ERROR:
+            return;
         default:
-            token += formula[i];
+            stack.pop_back();
             break;
         }
     }
-    if (token.empty())
-    {
-        std::cerr << "Thrown from parsePlusAndMinus\n";
-        throw std::invalid_argument("Not a valid formula there is a + or - sign at the end"); // throws to ParseAndEvaluate
-    }
-
-    tokens.push_back(token);
-    return tokens;
 }
 
-double FormulaParser::evaluateSingleToken(std::string &singleToken, spc::myset<std::pair<int, int>> &uniqueDependents) const
+FormulaValue FormulaParser::readReference(int row, int col, spc::myset<std::pair<int, int>> &uniqueDependents)
 {
-    std::pair<int, int> coordinates;
-    coordinates = getCellReference(singleToken);
-
-    if (coordinates != std::pair<int, int>(-1, -1))
-    {
-        Cell *cell = spreadsheet->getCell(coordinates.first, coordinates.second);
-        uniqueDependents.insert({cell->getRow(), cell->getCol()});
-
-        return cell->getCellValueAsDouble();
-    }
-
-    FunctionType func = getFunctionType(singleToken); // also checks if range is valid et cetera
-    if (func != FunctionType::INVALID)
-    {
-        std::string range = singleToken.substr(singleToken.find('(') + 1, singleToken.find(')') - singleToken.find('(') - 1);
+    if (!withinLimits(row, col))
+        return CellError::REF;
+    uniqueDependents.insert({row, col});
+    return readAt(row, col);
+}
 
-        int dotdotPos = range.find("..");
+FormulaValue FormulaParser::readAt(int row, int col)
+{
+    // The grid grows on demand: a cell past it is empty until something is entered there.
+    if (row >= spreadsheet->getRowCount() || col >= spreadsheet->getColCount())
+        return 0.0;
+    if (lazy)
+        refresh({row, col});
+    return readCell(spreadsheet->getCell(row, col));
+}
 
-        std::string startCell = range.substr(0, dotdotPos);
-        std::string endCell = range.substr(dotdotPos + 2);
+bool FormulaParser::withinLimits(int row, int col)
+{
+    return row >= 0 && col >= 0 && row < Spreadsheet::MAX_ROWS && col < Spreadsheet::MAX_COLS;
+}
 
-        std::pair<int, int> startPos = getCellReference(startCell);
-        std::pair<int, int> endPos = getCellReference(endCell);
+FormulaValue FormulaParser::readCell(Cell *cell)
+{
+    CellError error = cell->getError();
+    if (error != CellError::NONE)
+        return error;
+    return cell->getCellValueAsDouble();
+}
 
-        if (startPos == std::pair<int, int>(-1, -1) || endPos == std::pair<int, int>(-1, -1))
+template <typename Visit>
+FormulaValue FormulaParser::visitRange(FunctionType function, const Instruction &range, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents, Visit visit)
+{
+    int firstRow = range.absRow ? range.row : origin.first + range.row;
+    int firstCol = range.absCol ? range.col : origin.second + range.col;
+    int lastRow = range.endAbsRow ? range.endRow : origin.first + range.endRow;
+    int lastCol = range.endAbsCol ? range.endCol : origin.second + range.endCol;
+
+    if (!withinLimits(firstRow, firstCol) || !withinLimits(lastRow, lastCol))
+        return CellError::REF;
+
+    FormulaValue failure = 0.0;
+    forEachRangeCell(function, firstRow, firstCol, lastRow, lastCol, [&](int row, int col) {
+        ++stats.rangeReads;
+        uniqueDependents.insert({row, col});
+        FormulaValue value = readAt(row, col);
+        if (value.isError())
         {
-            throw std::invalid_argument("Invalid cell reference in function range.");
+            failure = value;
+            return false;
         }
-        switch (func)
+        visit(value.number);
+        return true;
+    });
+    return failure;
+}
+
+template <typename Step>
+void FormulaParser::forEachRangeCell(FunctionType function, int firstRow, int firstCol, int lastRow, int lastCol, Step step) const
+{
+    if (function == FunctionType::SUM || function == FunctionType::AVER)
+    {
+        // Reading order: the first row from the first corner on, whole rows, then the last
+        // row up to the second corner.
+        int cols = spreadsheet->getColCount();
+        int startRow = std::min(firstRow, lastRow), endRow = std::max(firstRow, lastRow);
+        int startCol = std::min(firstCol, lastCol), endCol = std::max(firstCol, lastCol);
+        for (int row = startRow; row <= endRow; ++row)
         {
-        case FunctionType::SUM:
-            return SUM(startPos, endPos, uniqueDependents);
-        case FunctionType::AVER:
-            return AVER(startPos, endPos, uniqueDependents);
-        case FunctionType::STDDEV:
-            return STDDEV(startPos, endPos, uniqueDependents);
-        case FunctionType::MAX:
-            return MAX(startPos, endPos, uniqueDependents);
-        case FunctionType::MIN:
-            return MIN(startPos, endPos, uniqueDependents);
-        case FunctionType::INVALID:
-            throw std::runtime_error("Invalid function type.\n");
+            int colStart = row == startRow ? startCol : 0;
+            int colEnd = row == endRow ? endCol : cols - 1;
+            for (int col = colStart; col <= colEnd; ++col)
+            {
+                if (!step(row, col))
+                    return;
+            }
         }
+        return;
     }
-    else if (isValue(singleToken))
+
+    for (int row = firstRow; row <= lastRow; ++row)
     {
-        try
-        {
-            return stod(singleToken);
-        }
-        catch (const std::invalid_argument &)
+        for (int col = firstCol; col <= lastCol; ++col)
         {
-            throw std::invalid_argument("token is not a valid");
+            if (!step(row, col))
+                return;
         }
     }
-    else
+}
+
+bool FormulaParser::rangeReads(const Aggregate &aggregate, std::pair<int, int> cell) const
+{
+    if (aggregate.function == FunctionType::SUM || aggregate.function == FunctionType::AVER)
     {
-        throw std::invalid_argument("token is not a valid cell reference function or numeric value");
-        ;
+        // The cells read in reading order are an interval of row-major positions.
+        long long cols = spreadsheet->getColCount();
+        long long start = std::min(aggregate.firstRow, aggregate.lastRow) * cols + std::min(aggregate.firstCol, aggregate.lastCol);
+        long long end = std::max(aggregate.firstRow, aggregate.lastRow) * cols + std::max(aggregate.firstCol, aggregate.lastCol);
+        long long position = cell.first * cols + cell.second;
+        return position >= start && position <= end;
     }
-    return 0.0;
+    return cell.first >= aggregate.firstRow && cell.first <= aggregate.lastRow &&
+           cell.second >= aggregate.firstCol && cell.second <= aggregate.lastCol;
 }
 
-std::pair<int, int> FormulaParser::getCellReference(const std::string &token) const
+FormulaValue FormulaParser::callFunction(FunctionType function, const Operand *args, int argc, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents)
 {
-    std::string str = removeSpaces(token);
-    for (int i = 0; i < spreadsheet->getRowCount(); ++i)
-        for (int j = 0; j < spreadsheet->getColCount(); ++j)
-            if (str == spreadsheet->getCell(i, j)->getLetterRepresentation())
-                return std::pair<int, int>(i, j);
-    return std::pair<int, int>(-1, -1);
+    if (memoizing && argc == 1 && args[0].range)
+        return callAggregate(function, *args[0].range, origin, uniqueDependents);
+    return applyFunction(function, args, argc, origin, uniqueDependents);
 }
 
-bool FormulaParser::isValidRange(const std::string &range) const
+FormulaValue FormulaParser::callAggregate(FunctionType function, const Instruction &range, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents)
 {
-    size_t dotPos = range.find("..");
-    if (dotPos == std::string::npos) // npos indicates fail
-        return false;
-
-    std::string startCell = range.substr(0, dotPos);
-    std::string endCell = range.substr(dotPos + 2);
+    Aggregate key{function};
+    key.firstRow = range.absRow ? range.row : origin.first + range.row;
+    key.firstCol = range.absCol ? range.col : origin.second + range.col;
+    key.lastRow = range.endAbsRow ? range.endRow : origin.first + range.endRow;
+    key.lastCol = range.endAbsCol ? range.endCol : origin.second + range.endCol;
+
+    auto same = [&](const Aggregate &aggregate) {
+        return aggregate.function == key.function && aggregate.firstRow == key.firstRow && aggregate.firstCol == key.firstCol &&
+               aggregate.lastRow == key.lastRow && aggregate.lastCol == key.lastCol;
+    };
+    auto found = std::find_if(aggregates.begin(), aggregates.end(), same);
+    if (found != aggregates.end())
+    {
+        // The cells it read are dependencies of this formula too.
+        ++stats.aggregateHits;
+        size_t remaining = found->reads;
+        forEachRangeCell(function, key.firstRow, key.firstCol, key.lastRow, key.lastCol, [&](int row, int col) {
+            if (remaining == 0)
+                return false;
+            --remaining;
+            uniqueDependents.insert({row, col});
+            return true;
+        });
+        return found->value;
+    }
 
-    return getCellReference(startCell) != std::pair<int, int>(-1, -1) &&
-           getCellReference(endCell) != std::pair<int, int>(-1, -1);
+    Operand argument{0.0, &range};
+    uint64_t readsBefore = stats.rangeReads;
+    key.value = applyFunction(function, &argument, 1, origin, uniqueDependents);
+    key.reads = static_cast<size_t>(stats.rangeReads - readsBefore);
+    if (key.reads >= MIN_AGGREGATE_CELLS && aggregates.size() < MAX_AGGREGATES)
+        aggregates.push_back(key);
+    return key.value;
 }
 
-FunctionType FormulaParser::getFunctionType(std::string &token) const
+void FormulaParser::forgetAggregatesReading(std::pair<int, int> cell)
 {
-    std::string str = removeSpaces(token);
+    if (aggregates.empty())
+        return;
+    aggregates.erase(std::remove_if(aggregates.begin(), aggregates.end(), [&](const Aggregate &aggregate) {
+        return rangeReads(aggregate, cell);
+    }), aggregates.end());
+}
 
-    size_t openParenPos = str.find('(');
-    size_t closeParenPos = str.find(')');
+FormulaValue FormulaParser::applyFunction(FunctionType function, const Operand *args, int argc, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents)
+{
+    double sum = 0.0;
+    int count = 0;
+    double maxValue = -std::numeric_limits<double>::infinity();
+    double minValue = std::numeric_limits<double>::infinity();
+    spc::myvec<double> values; // Only STDDEV needs them all
+
+    auto add = [&](double value) {
+        ++count;
+        if (function == FunctionType::MAX)
+            maxValue = std::max(maxValue, value);
+        else if (function == FunctionType::MIN)
+            minValue = std::min(minValue, value);
+        else
+        {
+            sum += value;
+            if (function == FunctionType::STDDEV)
+                values.push_back(value);
+        }
+    };
 
-    if (openParenPos != std::string::npos && closeParenPos != std::string::npos && closeParenPos > openParenPos)
+    for (int i = 0; i < argc; ++i)
     {
-        std::string range = str.substr(openParenPos + 1, closeParenPos - openParenPos - 1);
-
-        if (isValidRange(range))
+        if (!args[i].range)
         {
-            std::string funcName = str.substr(0, openParenPos);
-            if (funcName == "SUM")
-                return FunctionType::SUM;
-            else if (funcName == "AVER")
-                return FunctionType::AVER;
-            else if (funcName == "STDDEV")
-                return FunctionType::STDDEV;
-            else if (funcName == "MAX")
-                return FunctionType::MAX;
-            else if (funcName == "MIN")
-                return FunctionType::MIN;
+            add(args[i].number);
+            continue;
         }
+        FormulaValue failure = visitRange(function, *args[i].range, origin, uniqueDependents, add);
+        if (failure.isError())
+            return failure;
+    }
+
+    switch (function)
+    {
+    case FunctionType::SUM:
+        return sum;
+    case FunctionType::AVER:
+        return count == 0 ? 0.0 : sum / count;
+    case FunctionType::STDDEV:
+    {
+        if (count == 0)
+            return 0.0;
+        double mean = sum / count;
+        double varianceSum = 0.0;
+        for (double value : values)
+            varianceSum += (value - mean) * (value - mean);
+        return sqrt(varianceSum / count);
+    }
+    case FunctionType::MAX:
+        return maxValue;
+    case FunctionType::MIN:
+        return minValue;
+    case FunctionType::INVALID:
+        break;
     }
-    return FunctionType::INVALID;
+    return CellError::NAME;
 }
 
-double FormulaParser::SUM(std::pair<int, int> startPos, std::pair<int, int> endPos, spc::myset<std::pair<int, int>> &uniqueDependents) const
+void FormulaParser::autoCalculate(std::pair<int, int> coordinate)
 {
-    double result = 0.0;
-    spc::myvec<Cell *> cellsInRange = spreadsheet->getCellsInRange(startPos, endPos);
+    recalculate(planRecalculation({coordinate}));
+}
 
-    for (Cell *cell : cellsInRange)
+RecalcPlan FormulaParser::planRecalculation(const std::set<std::pair<int, int>> &roots) const
+{
+    // Every formula cell reachable from the roots.
+    std::set<std::pair<int, int>> affected;
+    std::vector<std::pair<int, int>> stack(roots.begin(), roots.end());
+    while (!stack.empty())
     {
-        uniqueDependents.insert({cell->getRow(), cell->getCol()});
-        result += cell->getCellValueAsDouble();
+        auto cell = stack.back();
+        stack.pop_back();
+        dependencies.forEachReader(cell, [&](std::pair<int, int> reader) {
+            if (affected.insert(reader).second)
+                stack.push_back(reader);
+        });
     }
-    return result;
+    return orderCells(affected);
 }
 
-double FormulaParser::AVER(std::pair<int, int> startPos, std::pair<int, int> endPos, spc::myset<std::pair<int, int>> &uniqueDependents) const
+RecalcPlan FormulaParser::orderCells(const std::set<std::pair<int, int>> &affected) const
 {
-    spc::myvec<Cell *> cellsInRange = spreadsheet->getCellsInRange(startPos, endPos);
-
-    if (cellsInRange.empty())
+    // Topological order within the affected cells (Kahn's algorithm). A cell waits for one
+    // input per (rectangle, affected cell in it), matching how often forEachReader reports it.
+    std::map<std::pair<int, int>, int> pendingInputs;
+    for (const auto &cell : affected)
     {
-        return 0.0;
+        int count = 0;
+        if (auto formulaCell = dynamic_cast<FormulaCell *>(spreadsheet->getCell(cell.first, cell.second)))
+        {
+            for (const CellRect &rect : formulaCell->fetchDependentRanges())
+            {
+                // Walk whichever is smaller: the rectangle or the affected cells.
+                size_t area = static_cast<size_t>(rect.bottom - rect.top + 1) * (rect.right - rect.left + 1);
+                if (area <= affected.size())
+                {
+                    for (int r = rect.top; r <= rect.bottom; ++r)
+                        for (int c = rect.left; c <= rect.right; ++c)
+                            count += static_cast<int>(affected.count({r, c}));
+                }
+                else
+                {
+                    for (const auto &other : affected)
+                        count += rect.contains(other) ? 1 : 0;
+                }
+            }
+        }
+        pendingInputs[cell] = count;
     }
 
-    double sum = 0.0;
-    int validCount = 0;
-    for (Cell *cell : cellsInRange)
+    RecalcPlan plan;
+    std::vector<std::pair<int, int>> &order = plan.cells;
+    for (const auto &[cell, count] : pendingInputs)
+        if (count == 0)
+            order.push_back(cell);
+    // A cell becomes ready only once every cell it reads was taken, so the cells made ready
+    // while taking one wave read none of one another and form the next.
+    auto take = [&](size_t from) {
+        size_t waveEnd = from;
+        for (size_t k = from; k < order.size(); ++k)
+        {
+            if (k == waveEnd)
+            {
+                plan.waves.push_back(k);
+                waveEnd = order.size();
+            }
+            dependencies.forEachReader(order[k], [&](std::pair<int, int> reader) {
+                if (affected.count(reader) && --pendingInputs[reader] == 0)
+                    order.push_back(reader);
+            });
+        }
+    };
+    take(0);
+
+    // The cells left never became ready: they lie on a cycle or read one. Only the former are
+    // set to #CYCLE!; taking them makes the others ready, and those read it like any error.
+    plan.acyclic = order.size();
+    std::set<std::pair<int, int>> cyclic = cellsOnCycles(pendingInputs);
+    for (const auto &cell : cyclic)
+        order.push_back(cell);
+    plan.cycleEnd = order.size();
+    for (size_t k = plan.acyclic; k < plan.cycleEnd; ++k)
     {
-        std::pair<int, int> cellCoords = {cell->getRow(), cell->getCol()};
-        uniqueDependents.insert(cellCoords);
-        sum += cell->getCellValueAsDouble();
-        validCount++;
+        dependencies.forEachReader(order[k], [&](std::pair<int, int> reader) {
+            if (affected.count(reader) && !cyclic.count(reader) && --pendingInputs[reader] == 0)
+                order.push_back(reader);
+        });
     }
-    if (validCount == 0)
-        return 0.0;
-
-    return sum / validCount;
+    take(plan.cycleEnd);
+    return plan;
 }
 
-double FormulaParser::STDDEV(std::pair<int, int> startPos, std::pair<int, int> endPos, spc::myset<std::pair<int, int>> &uniqueDependents) const
+std::set<std::pair<int, int>> FormulaParser::cellsOnCycles(const std::map<std::pair<int, int>, int> &pendingInputs) const
 {
-    double sum = 0.0;
-    int count = 0;
-    spc::myvec<double> values;
-
-    for (int row = startPos.first; row <= endPos.first; ++row)
+    // Strongly connected components of the cells left (Tarjan's algorithm, with an explicit
+    // stack, as a cycle may be as long as the sheet). A cell is on a cycle if its component
+    // holds another cell, or it reads itself.
+    struct Visit
+    {
+        std::pair<int, int> cell;
+        std::vector<std::pair<int, int>> readers;
+        size_t next = 0;
+    };
+    std::map<std::pair<int, int>, std::pair<size_t, size_t>> index; // (index, lowest index reachable)
+    std::vector<std::pair<int, int>> component;
+    std::set<std::pair<int, int>> onComponent, cyclic;
+    std::vector<Visit> path;
+    size_t counter = 0;
+
+    auto enter = [&](std::pair<int, int> cell) {
+        index[cell] = {counter, counter};
+        ++counter;
+        component.push_back(cell);
+        onComponent.insert(cell);
+        Visit visit{cell, {}};
+        dependencies.forEachReader(cell, [&](std::pair<int, int> reader) {
+            auto left = pendingInputs.find(reader);
+            if (left != pendingInputs.end() && left->second > 0)
+                visit.readers.push_back(reader);
+        });
+        path.push_back(std::move(visit));
+    };
+
+    for (const auto &[start, count] : pendingInputs)
     {
-        for (int col = startPos.second; col <= endPos.second; ++col)
+        if (count == 0 || index.count(start))
+            continue;
+        enter(start);
+        while (!path.empty())
         {
-            std::pair<int, int> pos(row, col);
-            uniqueDependents.insert(pos);
-            double numericValue = spreadsheet->getCell(row, col)->getCellValueAsDouble();
-            values.push_back(numericValue);
-            sum += numericValue;
-            ++count;
+            Visit &visit = path.back();
+            if (visit.next < visit.readers.size())
+            {
+                std::pair<int, int> reader = visit.readers[visit.next++];
+                if (reader == visit.cell)
+                    cyclic.insert(reader);
+                if (!index.count(reader))
+                    enter(reader);
+                else if (onComponent.count(reader))
+                    index[visit.cell].second = std::min(index[visit.cell].second, index[reader].first);
+                continue;
+            }
+
+            std::pair<int, int> cell = visit.cell;
+            path.pop_back();
+            if (!path.empty())
+                index[path.back().cell].second = std::min(index[path.back().cell].second, index[cell].second);
+            if (index[cell].second != index[cell].first)
+                continue;
+
+            // The cell is the root of a component: pop it.
+            size_t first = component.size();
+            while (component[--first] != cell)
+                ;
+            for (size_t i = first; i < component.size(); ++i)
+            {
+                onComponent.erase(component[i]);
+                if (component.size() - first > 1)
+                    cyclic.insert(component[i]);
+            }
+            component.resize(first);
         }
     }
-    if (count == 0)
-        return 0.0;
+    return cyclic;
+}
 
-    double mean = sum / count;
-    double varianceSum = 0.0;
+void FormulaParser::recalculate(const RecalcPlan &plan)
+{
+    // Cells only change as they are recalculated, and recalculateCell and recalculateColumn
+    // forget the aggregates that read them; none outlive the pass. A pass started by a lazy
+    // read in the middle of another shares its aggregates.
+    bool nested = memoizing;
+    memoizing = true;
+    bool cyclesSet = false;
+    for (size_t wave = 0; wave <= plan.waves.size(); ++wave)
+    {
+        // The cells on cycles come between the waves before them and those reading them.
+        size_t begin = wave < plan.waves.size() ? plan.waves[wave] : plan.cells.size();
+        if (begin >= plan.cycleEnd && !cyclesSet)
+        {
+            for (size_t i = plan.acyclic; i < plan.cycleEnd; ++i)
+                recalculateCell(plan.cells[i], true);
+            cyclesSet = true;
+        }
+        if (wave == plan.waves.size())
+            break;
 
-    for (double value : values)
+        size_t end = wave + 1 < plan.waves.size() ? plan.waves[wave + 1] : plan.cells.size();
+        if (begin < plan.acyclic)
+            end = std::min(end, plan.acyclic);
+        recalculateIndependent(plan.cells.data() + begin, end - begin);
+    }
+    if (!nested)
     {
-        varianceSum += (value - mean) * (value - mean);
+        memoizing = false;
+        aggregates.clear();
     }
-    double variance = varianceSum / count;
-    return sqrt(variance);
 }
 
-double FormulaParser::MAX(std::pair<int, int> startPos, std::pair<int, int> endPos, spc::myset<std::pair<int, int>> &uniqueDependents) const
+void FormulaParser::markStale(const std::set<std::pair<int, int>> &roots)
 {
-    double maxValue = -std::numeric_limits<double>::infinity(); // GPT s idea to get the lowest limit
+    std::vector<std::pair<int, int>> stack(roots.begin(), roots.end());
+    while (!stack.empty())
+    {
+        auto cell = stack.back();
+        stack.pop_back();
+        dependencies.forEachReader(cell, [&](std::pair<int, int> reader) {
+            auto formulaCell = dynamic_cast<FormulaCell *>(spreadsheet->getCell(reader.first, reader.second));
+            if (formulaCell && !isStale(*formulaCell))
+            {
+                formulaCell->setComputedAt(0);
+                stack.push_back(reader);
+            }
+        });
+    }
+}
 
-    for (int row = startPos.first; row <= endPos.first; ++row)
+void FormulaParser::refresh(std::pair<int, int> coordinate)
+{
+    if (coordinate.first >= spreadsheet->getRowCount() || coordinate.second >= spreadsheet->getColCount())
+        return;
+    auto formulaCell = dynamic_cast<FormulaCell *>(spreadsheet->getCell(coordinate.first, coordinate.second));
+    if (!formulaCell || !isStale(*formulaCell))
+        return;
+
+    // The stale formulas it reads, directly or through one another, as their dependency lists tell.
+    std::set<std::pair<int, int>> stale{coordinate};
+    std::vector<FormulaCell *> stack{formulaCell};
+    while (!stack.empty())
     {
-        for (int col = startPos.second; col <= endPos.second; ++col)
-        {
-            std::pair<int, int> pos(row, col);
-            uniqueDependents.insert(pos);
-            double content = spreadsheet->getCell(row, col)->getCellValueAsDouble();
-            maxValue = std::max(maxValue, content);
-        }
+        FormulaCell *cell = stack.back();
+        stack.pop_back();
+        cell->forEachDependentCell([&](std::pair<int, int> input) {
+            if (input.first >= spreadsheet->getRowCount() || input.second >= spreadsheet->getColCount())
+                return;
+            auto inputCell = dynamic_cast<FormulaCell *>(spreadsheet->getCell(input.first, input.second));
+            if (inputCell && isStale(*inputCell) && stale.insert(input).second)
+                stack.push_back(inputCell);
+        });
     }
-    return maxValue;
+
+    // They are taken as fresh from here on: a formula reading one of them unrecorded sees its
+    // current value, as it would in an eager pass, instead of starting another refresh.
+    RecalcPlan plan = orderCells(stale);
+    for (const auto &cell : plan.cells)
+        markFresh(*static_cast<FormulaCell *>(spreadsheet->getCell(cell.first, cell.second)));
+    recalculate(plan);
 }
 
-double FormulaParser::MIN(std::pair<int, int> startPos, std::pair<int, int> endPos, spc::myset<std::pair<int, int>> &uniqueDependents) const
+void FormulaParser::recalculateIndependent(const std::pair<int, int> *cells, size_t count)
 {
-    double minValue = std::numeric_limits<double>::infinity();
+    if (count < MIN_COLUMN_ROWS)
+    {
+        for (size_t i = 0; i < count; ++i)
+            recalculateCell(cells[i]);
+        return;
+    }
+
+    // Find the runs down each column of cells sharing an arithmetic template.
+    std::vector<size_t> byColumn(count);
+    for (size_t i = 0; i < byColumn.size(); ++i)
+        byColumn[i] = i;
+    std::sort(byColumn.begin(), byColumn.end(), [&](size_t a, size_t b) {
+        return cells[a].second != cells[b].second ? cells[a].second < cells[b].second : cells[a].first < cells[b].first;
+    });
+
+    std::vector<std::vector<FormulaCell *>> runs;
+    std::vector<std::pair<int, int>> runTops;
+    std::vector<size_t> runOf(count, SIZE_MAX);
+    for (size_t i = 0; i < byColumn.size();)
+    {
+        std::pair<int, int> top = cells[byColumn[i]];
+        auto first = dynamic_cast<FormulaCell *>(spreadsheet->getCell(top.first, top.second));
+        size_t end = i + 1;
+        if (first && isColumnwise(first->getTemplate().program))
+        {
+            while (end < byColumn.size() && end - i < MAX_COLUMN_ROWS)
+            {
+                std::pair<int, int> cell = cells[byColumn[end]];
+                if (cell.second != top.second || cell.first != top.first + static_cast<int>(end - i))
+                    break;
+                auto next = dynamic_cast<FormulaCell *>(spreadsheet->getCell(cell.first, cell.second));
+                if (!next || &next->getTemplate() != &first->getTemplate())
+                    break;
+                ++end;
+            }
+        }
+
+        if (end - i >= MIN_COLUMN_ROWS)
+        {
+            runs.emplace_back();
+            runTops.push_back(top);
+            for (size_t k = i; k < end; ++k)
+            {
+                runs.back().push_back(static_cast<FormulaCell *>(spreadsheet->getCell(cells[byColumn[k]].first, cells[byColumn[k]].second)));
+                runOf[byColumn[k]] = runs.size() - 1;
+            }
+        }
+        i = end;
+    }
 
-    for (int row = startPos.first; row <= endPos.first; ++row)
+    // The cells are taken in the order given, a run when its first cell comes up. Dependency
+    // lists are those of each cell's last evaluation, so a cell may still read one of the others
+    // unrecorded, e.g. a SUM over whole rows after the grid widened; outside the runs, it then
+    // sees what it would see evaluated cell by cell.
+    std::vector<bool> done(runs.size(), false);
+    for (size_t i = 0; i < count; ++i)
     {
-        for (int col = startPos.second; col <= endPos.second; ++col)
+        if (runOf[i] == SIZE_MAX)
+            recalculateCell(cells[i]);
+        else if (!done[runOf[i]])
         {
-            std::pair<int, int> pos(row, col);
-            uniqueDependents.insert(pos);
-            double content = spreadsheet->getCell(row, col)->getCellValueAsDouble();
-            minValue = std::min(minValue, content);
+            done[runOf[i]] = true;
+            recalculateColumn(runs[runOf[i]].front()->getTemplate(), runTops[runOf[i]], runs[runOf[i]]);
         }
     }
-    return minValue;
 }
 
-void FormulaParser::autoCalculate(std::pair<int, int> coordinate)
+bool FormulaParser::isColumnwise(const FormulaProgram &program)
 {
-    static std::set<std::pair<int, int>> visited; // Tracks already processed cells
-    if (visited.find(coordinate) != visited.end())
-        return; // Skip if already processed
-
-    visited.insert(coordinate); // Mark this cell as visited
+    for (const Instruction &instruction : program.code)
+    {
+        if (instruction.op == OpCode::RANGE || instruction.op == OpCode::CALL || instruction.op == OpCode::ERROR)
+            return false;
+    }
+    return !program.code.empty();
+}
 
-    for (int i = 0; i < spreadsheet->getRowCount(); i++)
+void FormulaParser::recalculateColumn(const FormulaTemplate &formula, std::pair<int, int> top, const std::vector<FormulaCell *> &cells)
+{
+    const size_t rows = cells.size();
+    const std::vector<Instruction> &code = formula.program.code;
+    size_t references = std::count_if(code.begin(), code.end(), [](const Instruction &instruction) {
+        return instruction.op == OpCode::CELL;
+    });
+
+    // One column of the operand stack per depth, one error per row: a row stops reading
+    // cells at its first error, exactly like execute(), but the arithmetic runs on regardless
+    // and its result is ignored.
+    std::vector<double> stack(formula.program.maxDepth * rows);
+    std::vector<CellError> errors(rows, CellError::NONE);
+    std::vector<std::pair<int, int>> reads(references * rows); // The cells each row read, first read first
+    std::vector<size_t> readCount(rows, 0);
+
+    size_t depth = 0;
+    for (const Instruction &instruction : code)
     {
-        for (int j = 0; j < spreadsheet->getColCount(); j++)
+        switch (instruction.op)
         {
-            if (auto formulaCell = dynamic_cast<FormulaCell *>(spreadsheet->getCell(i, j)))
+        case OpCode::NUMBER:
+            std::fill_n(&stack[depth++ * rows], rows, instruction.number);
+            break;
+        case OpCode::CELL:
+        {
+            double *out = &stack[depth++ * rows];
+            for (size_t i = 0; i < rows; ++i)
             {
-                spc::myvec<std::pair<int, int>> dependentCells = formulaCell->fetchDependentCells();
-                if (std::find(dependentCells.begin(), dependentCells.end(), coordinate) != dependentCells.end())
+                int row = instruction.absRow ? instruction.row : top.first + static_cast<int>(i) + instruction.row;
+                int col = instruction.absCol ? instruction.col : top.second + instruction.col;
+                if (!withinLimits(row, col))
+                {
+                    if (errors[i] == CellError::NONE)
+                        errors[i] = CellError::REF;
+                    continue;
+                }
+
+                // Recorded even past the row's first error, as evaluate() does.
+                std::pair<int, int> *rowReads = &reads[i * references];
+                if (std::find(rowReads, rowReads + readCount[i], std::pair<int, int>(row, col)) == rowReads + readCount[i])
+                    rowReads[readCount[i]++] = {row, col};
+                if (errors[i] != CellError::NONE)
                 {
-                    std::string formula = formulaCell->getFormula();
-                    if (!formula.empty() && formula[0] == '=')
-                    {
-                        try
-                        {
-                            spc::myvec<std::pair<int, int>> newDependentCells;
-                            double newValue = parseAndEvaluate(formula, {i, j}, newDependentCells);
-                            formulaCell->setCalculatedValue(newValue);
-                            for (auto &pair : newDependentCells)
-                                formulaCell->addDependentCell(pair);
-
-                            autoCalculate({i, j}); // Recursively process this cell's dependencies
-                        }
-                        catch (const std::exception &e)
-                        {
-                            std::cerr << "Error recalculating cell (" << i << ", " << j << "): " << e.what() << std::endl;
-                        }
-                    }
+                    if (lazy)
+                        refresh({row, col});
+                    continue;
                 }
+                FormulaValue value = readAt(row, col);
+                errors[i] = value.error;
+                out[i] = value.number;
             }
+            break;
+        }
+        case OpCode::NEG:
+        {
+            double *a = &stack[(depth - 1) * rows];
+            for (size_t i = 0; i < rows; ++i)
+                a[i] = -a[i];
+            break;
+        }
+        default:
+        {
+            // Branch-free loops over whole columns, which the compiler can vectorize.
+            const double *b = &stack[--depth * rows];
+            double *a = &stack[(depth - 1) * rows];
+            switch (instruction.op)
+            {
+            case OpCode::ADD: for (size_t i = 0; i < rows; ++i) a[i] = a[i] + b[i]; break;
+            case OpCode::SUB: for (size_t i = 0; i < rows; ++i) a[i] = a[i] - b[i]; break;
+            case OpCode::MUL: for (size_t i = 0; i < rows; ++i) a[i] = a[i] * b[i]; break;
+            case OpCode::DIV:
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    if (b[i] == 0.0 && errors[i] == CellError::NONE)
+                        errors[i] = CellError::DIV0;
+                    a[i] = a[i] / b[i];
+                }
+                break;
+            case OpCode::EQ: for (size_t i = 0; i < rows; ++i) a[i] = a[i] == b[i]; break;
+            case OpCode::NE: for (size_t i = 0; i < rows; ++i) a[i] = a[i] != b[i]; break;
+            case OpCode::LT: for (size_t i = 0; i < rows; ++i) a[i] = a[i] < b[i]; break;
+            case OpCode::LE: for (size_t i = 0; i < rows; ++i) a[i] = a[i] <= b[i]; break;
+            case OpCode::GT: for (size_t i = 0; i < rows; ++i) a[i] = a[i] > b[i]; break;
+            case OpCode::GE: for (size_t i = 0; i < rows; ++i) a[i] = a[i] >= b[i]; break;
+            default: break;
+            }
+            break;
+        }
         }
     }
-    visited.erase(coordinate); // Remove this cell from visited after processing
+
+    stats.evaluations += rows;
+    for (size_t i = 0; i < rows; ++i)
+    {
+        FormulaCell *cell = cells[i];
+        if (errors[i] != CellError::NONE)
+            cell->setError(errors[i]);
+        else
+            cell->setCalculatedValue(stack[i] + 0.0); // Turns -0 into 0, as execute() does
+        markFresh(*cell);
+        forgetAggregatesReading({top.first + static_cast<int>(i), top.second});
+        const std::pair<int, int> *rowReads = reads.data() + i * references;
+        if (cell->replaceDependentCells(rowReads, rowReads + readCount[i]))
+            trackDependencies({top.first + static_cast<int>(i), top.second}, *cell);
+    }
+}
+
+void FormulaParser::recalculateCell(std::pair<int, int> coordinate, bool onCycle)
+{
+    auto formulaCell = dynamic_cast<FormulaCell *>(spreadsheet->getCell(coordinate.first, coordinate.second));
+    if (!formulaCell)
+        return;
+
+    // Its dependencies stay as they are, so the cell is replanned once the cycle is broken.
+    if (onCycle)
+    {
+        formulaCell->setError(CellError::CYCLE);
+        markFresh(*formulaCell);
+        forgetAggregatesReading(coordinate);
+        return;
+    }
+
+    spc::myvec<std::pair<int, int>> newDependentCells;
+    FormulaValue newValue = evaluate(formulaCell->getTemplate(), coordinate, newDependentCells);
+    if (newValue.isError())
+        formulaCell->setError(newValue.error);
+    else
+        formulaCell->setCalculatedValue(newValue.number);
+    markFresh(*formulaCell);
+    forgetAggregatesReading(coordinate);
+    if (formulaCell->replaceDependentCells(newDependentCells.begin(), newDependentCells.end()))
+        trackDependencies(coordinate, *formulaCell);
 }
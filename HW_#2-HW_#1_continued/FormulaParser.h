@@ -1,28 +1,75 @@
 #ifndef PARSE_EM
 #define PARSE_EM
 
+#include "Cell.h"
 #include "myvec.h"
 #include "myset.h"
+#include "DependencyIndex.h"
+#include "FormulaProgram.h"
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+
+class Spreadsheet;
 
 /**
- * @enum FunctionType
- * @brief Represents the types of functions that can be parsed and evaluated.
+ * @struct FormulaValue
+ * @brief The result of evaluating a formula or a part of it: a number, or the error
+ *        that replaces it. Errors are returned like numbers rather than thrown, so a
+ *        broken input costs the formulas downstream of it no more than a valid one.
  */
-enum class FunctionType
+struct FormulaValue
 {
-    SUM,    ///< Sum of values in a range.
-    AVER,   ///< Average of values in a range.
-    STDDEV, ///< Standard deviation of values in a range.
-    MAX,    ///< Maximum value in a range.
-    MIN,    ///< Minimum value in a range.
-    INVALID ///< Invalid function type.
+    double number = 0.0;               ///< The value; 0 if error is set.
+    CellError error = CellError::NONE; ///< The first error met, or CellError::NONE.
+
+    FormulaValue(double n = 0.0) : number(n) {}
+    FormulaValue(CellError e) : error(e) {}
+
+    /**
+     * @brief Tells whether the evaluation failed.
+     * @return True if error is set.
+     */
+    bool isError() const { return error != CellError::NONE; }
 };
 
-class Spreadsheet;
+/**
+ * @struct RecalcPlan
+ * @brief The formula cells to recalculate after an edit, in evaluation order.
+ */
+struct RecalcPlan
+{
+    std::vector<std::pair<int, int>> cells; ///< Every cell comes after the cells it reads, except those on a cycle.
+    size_t acyclic = 0; ///< Cells from this index on, up to cycleEnd, lie on a reference cycle.
+    size_t cycleEnd = 0; ///< The cells from this index on read a cycle, and come after it.
+    std::vector<size_t> waves; ///< Where each wave of cells that read none of one another begins in cells.
+
+    /**
+     * @brief Tells whether a planned cell is part of a cycle.
+     * @param index Position of the cell in cells.
+     * @return True if the cell cannot be ordered and evaluates to #CYCLE!. The cells reading
+     *         it are evaluated, and show #CYCLE! if it is the first error they meet.
+     */
+    bool onCycle(size_t index) const { return index >= acyclic && index < cycleEnd; }
+};
+
+/**
+ * @struct ParserStats
+ * @brief Counters describing the work done by a FormulaParser.
+ */
+struct ParserStats
+{
+    uint64_t evaluations = 0;     ///< Number of formulas evaluated.
+    uint64_t templateLookups = 0; ///< Number of formulas looked up among the shared templates.
+    uint64_t templateHits = 0;    ///< Number of lookups that found an equal template to share, sparing the compile.
+    uint64_t rangeReads = 0;      ///< Number of cells read by range arguments.
+    uint64_t aggregateHits = 0;   ///< Number of range aggregates reused within a recalculation instead of read again.
+};
 
 /**
  * @class FormulaParser
@@ -37,14 +84,34 @@ public:
      */
     FormulaParser(Spreadsheet *sheet) : spreadsheet(sheet) {}
 
+    /**
+     * @brief Compiles a formula entered in a cell, sharing the template of an equal formula,
+     *        such as one filled down from the same column.
+     * @param formula The formula, starting with '='.
+     * @param coordinates The coordinates of the cell containing the formula.
+     * @return The template, to be stored in the cell's FormulaCell.
+     */
+    std::shared_ptr<const FormulaTemplate> compile(const std::string &formula, std::pair<int, int> coordinates);
+
+    /**
+     * @brief Evaluates a compiled formula in a cell.
+     * @param formula The template of the formula.
+     * @param coordinates The coordinates of the cell; relative references are resolved against them.
+     * @param dependentCells A vector to store dependent cell coordinates: every cell the
+     *        formula refers to, including those past an error that stopped the evaluation.
+     * @return The calculated result of the formula, or the error it evaluates to.
+     */
+    FormulaValue evaluate(const FormulaTemplate &formula, std::pair<int, int> coordinates, spc::myvec<std::pair<int, int>> &dependentCells);
+
     /**
      * @brief Parses and evaluates a formula, updating dependent cells as needed.
      * @param formula The formula string to parse and evaluate.
      * @param coordinates The coordinates of the cell containing the formula.
-     * @param dependentCells A vector to store dependent cell coordinates.
-     * @return The calculated result of the formula.
+     * @param dependentCells A vector to store dependent cell coordinates: every cell the
+     *        formula refers to, including those past an error that stopped the evaluation.
+     * @return The calculated result of the formula, or the error it evaluates to.
      */
-    double parseAndEvaluate(std::string &formula, std::pair<int, int> coordinates, spc::myvec<std::pair<int, int>> &dependentCells);
+    FormulaValue parseAndEvaluate(std::string &formula, std::pair<int, int> coordinates, spc::myvec<std::pair<int, int>> &dependentCells);
 
     /**
      * @brief Automatically recalculates cells dependent on a specified cell.
@@ -52,111 +119,309 @@ public:
      */
     void autoCalculate(std::pair<int, int> coordinate);
 
+    /**
+     * @brief Lists the formula cells that depend, directly or indirectly, on any of the given cells,
+     *        ordered so that every cell comes after the cells it reads. Cells on a cycle cannot
+     *        be ordered; they come after the others, followed by the cells reading them.
+     * @param roots The cells that changed.
+     * @return The cells to recalculate, in evaluation order.
+     */
+    RecalcPlan planRecalculation(const std::set<std::pair<int, int>> &roots) const;
+
+    /**
+     * @brief Recalculates the cells of a plan, a wave at a time. While it runs, a function of a
+     *        single large range, such as SUM(B2..B5000), is computed once and reused by every
+     *        formula calling it, until a cell it read changes.
+     * @param plan The plan, as returned by planRecalculation.
+     */
+    void recalculate(const RecalcPlan &plan);
+
+    /**
+     * @brief Re-evaluates formula cells that read none of one another, so in any order. Runs of
+     *        cells down a column holding the same arithmetic template, as left by filling a
+     *        formula down, are evaluated a column at a time rather than cell by cell.
+     * @param cells The coordinates of the cells.
+     * @param count The number of cells.
+     */
+    void recalculateIndependent(const std::pair<int, int> *cells, size_t count);
+
+    /**
+     * @brief Re-evaluates a single formula cell and refreshes its dependency list.
+     *        Does nothing if the cell no longer holds a formula.
+     * @param coordinate The coordinates of the cell.
+     * @param onCycle True if the plan found the cell on a cycle; it is set to #CYCLE! without evaluating.
+     */
+    void recalculateCell(std::pair<int, int> coordinate, bool onCycle = false);
+
+    /**
+     * @brief Switches between eager and lazy evaluation. Eagerly, the caller recalculates the
+     *        formulas downstream of an edit right away; lazily, it only marks them stale, and a
+     *        stale formula is computed when refresh asks for its value or another formula reads it.
+     * @param l True for lazy evaluation.
+     */
+    void setLazy(bool l) { lazy = l; }
+
+    /**
+     * @brief Tells whether evaluation is lazy, see setLazy.
+     * @return True if edits only mark their dependents stale.
+     */
+    bool isLazy() const { return lazy; }
+
+    /**
+     * @brief Marks every formula cell depending, directly or indirectly, on any of the given
+     *        cells stale, without evaluating any. The walk stops at formulas already stale:
+     *        their readers were marked along with them.
+     * @param roots The cells that changed.
+     */
+    void markStale(const std::set<std::pair<int, int>> &roots);
+
+    /**
+     * @brief Marks every formula cell of the sheet stale at once by starting a new generation:
+     *        values computed in an earlier one are out of date.
+     */
+    void markAllStale() { ++generation; }
+
+    /**
+     * @brief Tells whether a formula cell's value may be out of date.
+     * @param cell The formula cell.
+     * @return True if it was marked stale, or computed before the current generation.
+     */
+    bool isStale(const FormulaCell &cell) const { return cell.getComputedAt() < generation; }
+
+    /**
+     * @brief Records a formula cell's value as up to date, e.g. right after it was entered.
+     * @param cell The formula cell.
+     */
+    void markFresh(FormulaCell &cell) const { cell.setComputedAt(generation); }
+
+    /**
+     * @brief Brings a cell's value up to date if it is a stale formula, recalculating it and the
+     *        stale formulas it reads, directly or not, in dependency order. Does nothing otherwise,
+     *        or for a cell past the grid, so it is cheap to call for every cell about to be shown.
+     * @param coordinate The coordinates of the cell.
+     */
+    void refresh(std::pair<int, int> coordinate);
+
+    /**
+     * @brief Records the cells a formula cell reads, so planRecalculation finds it as their reader.
+     *        Called whenever a formula cell is created or its dependency list is refreshed.
+     * @param coordinate The coordinates of the formula cell.
+     * @param cell The formula cell.
+     */
+    void trackDependencies(std::pair<int, int> coordinate, const FormulaCell &cell) { dependencies.assign(coordinate, cell.fetchDependentRanges()); }
+
+    /**
+     * @brief Forgets the dependencies recorded for a cell, e.g. because it was overwritten.
+     * @param coordinate The coordinates of the cell.
+     */
+    void forgetDependencies(std::pair<int, int> coordinate) { dependencies.remove(coordinate); }
+
+    /**
+     * @brief Returns the parser's counters.
+     * @return The counters accumulated since the parser was created.
+     */
+    const ParserStats &getStats() const { return stats; }
+
 private:
     Spreadsheet *spreadsheet; ///< Pointer to the associated Spreadsheet object.
+    std::unordered_map<std::string, std::weak_ptr<const FormulaTemplate>> templates; ///< Templates in use, by key.
+    std::string key; ///< The key of the formula being compiled, kept to reuse its buffer.
+    size_t templatesAfterPurge = 0; ///< Size of templates after expired entries were last dropped.
+    ParserStats stats; ///< Counters shown by the performance HUD.
+    DependencyIndex dependencies; ///< The readers of every cell, maintained by trackDependencies.
+    bool lazy = false; ///< Whether formulas read stale cells are refreshed first, see setLazy.
+    uint32_t generation = 1; ///< Formula cells computed before this generation are stale.
+
+    /** @brief Expired templates tolerated beyond the live ones before they are dropped. */
+    static constexpr size_t MIN_EXPIRED_BEFORE_PURGE = 1024;
+
+    /** @brief Smallest range whose aggregate is worth remembering during a recalculation. */
+    static constexpr size_t MIN_AGGREGATE_CELLS = 16;
+
+    /** @brief Most aggregates remembered at once; every recalculated cell is checked against them. */
+    static constexpr size_t MAX_AGGREGATES = 256;
 
     /**
-     * @brief Splits a formula into tokens based on addition and subtraction operators.
-     * @param formula The formula string to parse.
-     * @return A vector of tokens split by addition and subtraction operators.
+     * @brief A function of one range, computed during the current recalculation.
      */
-    spc::myvec<std::string> parsePlusAndMinus(const std::string &formula) const;
+    struct Aggregate
+    {
+        FunctionType function;               ///< The function.
+        int firstRow, firstCol;              ///< The first corner of the range, resolved.
+        int lastRow, lastCol;                ///< The second corner.
+        FormulaValue value;                  ///< The result of the call.
+        size_t reads;                        ///< Cells read, in order, up to the value; replayed as dependencies.
+    };
+
+    std::vector<Aggregate> aggregates; ///< Aggregates computed since the recalculation began.
+    bool memoizing = false; ///< True while recalculate() runs; aggregates are kept only then.
+
+    /** @brief Shortest run of cells worth evaluating a column at a time. */
+    static constexpr size_t MIN_COLUMN_ROWS = 4;
+
+    /** @brief Longest run evaluated at once; longer ones are split, bounding the buffers. */
+    static constexpr size_t MAX_COLUMN_ROWS = 1024;
 
     /**
-     * @brief Splits a token into sub-tokens based on multiplication and division operators.
-     * @param token The token to parse.
-     * @return A vector of sub-tokens split by multiplication and division operators.
+     * @brief An entry of the operand stack: a number, or a range argument waiting for its function.
      */
-    spc::myvec<std::string> parseMultpAndDiv(const std::string &token) const;
+    struct Operand
+    {
+        double number;            ///< The value, if range is null.
+        const Instruction *range; ///< The RANGE instruction of a range argument, or null.
+    };
 
     /**
-     * @brief Evaluates a token containing multiplication and division operations.
-     * @param token The token to evaluate.
-     * @param uniqueDependents A set to store unique dependent cell coordinates.
-     * @return The evaluated result of the token.
+     * @brief Orders formula cells so that every cell comes after the cells it reads, among
+     *        the given ones (Kahn's algorithm); see planRecalculation.
+     * @param cells The formula cells.
+     * @return The cells in evaluation order, see RecalcPlan.
      */
-    double evaluateMultpAndDivToken(std::string &token, spc::myset<std::pair<int, int>> &uniqueDependents) const;
+    RecalcPlan orderCells(const std::set<std::pair<int, int>> &cells) const;
 
     /**
-     * @brief Checks if a given range string is valid.
-     * @param range The range string to validate.
-     * @return True if the range is valid, false otherwise.
+     * @brief Picks, among cells Kahn's algorithm could not order, those lying on a cycle rather
+     *        than only reading one.
+     * @param pendingInputs The cells being ordered, with the inputs each still waits for.
+     * @return The cells still waiting that lie on a cycle.
      */
-    bool isValidRange(const std::string &range) const;
+    std::set<std::pair<int, int>> cellsOnCycles(const std::map<std::pair<int, int>, int> &pendingInputs) const;
 
     /**
-     * @brief Converts a cell reference string to its row and column coordinates.
-     * @param token The cell reference string.
-     * @return A pair representing the row and column coordinates.
+     * @brief Runs a compiled formula.
+     * @param program The program.
+     * @param origin The cell holding the formula.
+     * @param uniqueDependents A set to store unique dependent cell coordinates.
+     * @return The value of the formula, or the first error met; evaluation stops there.
      */
-    std::pair<int, int> getCellReference(const std::string &token) const;
+    FormulaValue execute(const FormulaProgram &program, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents);
 
     /**
-     * @brief Determines the type of function represented by a token.
-     * @param token The token to analyze.
-     * @return The corresponding FunctionType.
+     * @brief Evaluates a run of cells down a column holding the same template, one instruction
+     *        at a time over the whole run, and stores their values and dependencies. Each cell
+     *        gets exactly what recalculateCell would give it.
+     * @param formula The template; its program must be arithmetic, see isColumnwise.
+     * @param top The coordinates of the first cell.
+     * @param cells The cells, one per row from top down.
      */
-    FunctionType getFunctionType(std::string &token) const;
+    void recalculateColumn(const FormulaTemplate &formula, std::pair<int, int> top, const std::vector<FormulaCell *> &cells);
 
     /**
-     * @brief Checks if a token represents a numerical value.
-     * @param token The token to check.
-     * @return True if the token is a value, false otherwise.
+     * @brief Tells whether a program only reads single cells and combines them with operators,
+     *        so that it can run over a column of cells at once.
+     * @param program The program.
+     * @return False if it calls a function or failed to compile.
      */
-    bool isValue(const std::string &token) const;
+    static bool isColumnwise(const FormulaProgram &program);
 
     /**
-     * @brief Evaluates a single token and updates dependent cells.
-     * @param singleToken The token to evaluate.
+     * @brief Records every cell a program refers to, whether or not evaluating it reads them,
+     *        e.g. because it stops at an error first.
+     * @param program The program.
+     * @param origin The cell holding the formula.
      * @param uniqueDependents A set to store unique dependent cell coordinates.
-     * @return The evaluated result of the token.
      */
-    double evaluateSingleToken(std::string &singleToken, spc::myset<std::pair<int, int>> &uniqueDependents) const;
+    void recordReferences(const FormulaProgram &program, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents) const;
 
     /**
-     * @brief Calculates the sum of values in a specified range.
-     * @param startPos The starting coordinates of the range.
-     * @param endPos The ending coordinates of the range.
+     * @brief Reads a referenced cell.
+     * @param row The row of the cell; negative if a relative reference points above the sheet.
+     * @param col The column of the cell; negative if a relative reference points left of the sheet.
      * @param uniqueDependents A set to store unique dependent cell coordinates.
-     * @return The sum of values in the range.
+     * @return The value of the cell, the error it holds, or #REF! if it lies beyond the sheet's
+     *         limits (Spreadsheet::MAX_ROWS and MAX_COLS).
      */
-    double SUM(std::pair<int, int> startPos, std::pair<int, int> endPos, spc::myset<std::pair<int, int>> &uniqueDependents) const;
+    FormulaValue readReference(int row, int col, spc::myset<std::pair<int, int>> &uniqueDependents);
 
     /**
-     * @brief Calculates the average of values in a specified range.
-     * @param startPos The starting coordinates of the range.
-     * @param endPos The ending coordinates of the range.
-     * @param uniqueDependents A set to store unique dependent cell coordinates.
-     * @return The average of values in the range.
+     * @brief Reads a cell within the sheet's limits; in lazy mode a stale formula is refreshed first.
+     * @param row The row of the cell.
+     * @param col The column of the cell.
+     * @return The value of the cell or the error it holds; a cell past the grid is empty and reads as 0.
+     */
+    FormulaValue readAt(int row, int col);
+
+    /**
+     * @brief Tells whether a cell lies within the sheet's limits, which the grid may grow to.
+     * @param row The row; may be negative for a relative reference above the sheet.
+     * @param col The column; may be negative for a relative reference left of the sheet.
+     * @return True if it can be referred to.
+     */
+    static bool withinLimits(int row, int col);
+
+    /**
+     * @brief Reads the value of a cell for a formula.
+     * @param cell The cell.
+     * @return Its numeric value, or the error it holds.
      */
-    double AVER(std::pair<int, int> startPos, std::pair<int, int> endPos, spc::myset<std::pair<int, int>> &uniqueDependents) const;
+    static FormulaValue readCell(Cell *cell);
 
     /**
-     * @brief Calculates the standard deviation of values in a specified range.
-     * @param startPos The starting coordinates of the range.
-     * @param endPos The ending coordinates of the range.
+     * @brief Evaluates a function over its arguments.
+     * @param function The function.
+     * @param args The arguments: numbers, or the RANGE instructions of range arguments.
+     * @param argc The number of arguments.
+     * @param origin The cell holding the formula.
      * @param uniqueDependents A set to store unique dependent cell coordinates.
-     * @return The standard deviation of values in the range.
+     * @return The result, or the first error in the arguments' cells.
      */
-    double STDDEV(std::pair<int, int> startPos, std::pair<int, int> endPos, spc::myset<std::pair<int, int>> &uniqueDependents) const;
+    FormulaValue callFunction(FunctionType function, const Operand *args, int argc, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents);
 
     /**
-     * @brief Finds the maximum value in a specified range.
-     * @param startPos The starting coordinates of the range.
-     * @param endPos The ending coordinates of the range.
+     * @brief Evaluates a function over its arguments, reading every range; see callFunction.
+     */
+    FormulaValue applyFunction(FunctionType function, const Operand *args, int argc, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents);
+
+    /**
+     * @brief Evaluates a function of a single range, reusing the result if another formula
+     *        computed it during the current recalculation. The cells it read are listed as
+     *        dependencies either way.
+     * @param function The function.
+     * @param range The RANGE instruction of its argument.
+     * @param origin The cell holding the formula.
      * @param uniqueDependents A set to store unique dependent cell coordinates.
-     * @return The maximum value in the range.
+     * @return The result, as callFunction would compute it.
+     */
+    FormulaValue callAggregate(FunctionType function, const Instruction &range, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents);
+
+    /**
+     * @brief Forgets the aggregates that read a cell, because its value changed.
+     * @param cell The (row, column) of the cell.
      */
-    double MAX(std::pair<int, int> startPos, std::pair<int, int> endPos, spc::myset<std::pair<int, int>> &uniqueDependents) const;
+    void forgetAggregatesReading(std::pair<int, int> cell);
 
     /**
-     * @brief Finds the minimum value in a specified range.
-     * @param startPos The starting coordinates of the range.
-     * @param endPos The ending coordinates of the range.
+     * @brief Calls a function with the value of every cell of a range, in the order the function
+     *        reads them, see forEachRangeCell.
+     * @param function The function reading the range.
+     * @param range The RANGE instruction.
+     * @param origin The cell holding the formula.
      * @param uniqueDependents A set to store unique dependent cell coordinates.
-     * @return The minimum value in the range.
+     * @param visit Called with each value.
+     * @return The first error among the cells, #REF! if the range reaches beyond the sheet's limits,
+     *         or a value without an error.
+     */
+    template <typename Visit>
+    FormulaValue visitRange(FunctionType function, const Instruction &range, std::pair<int, int> origin, spc::myset<std::pair<int, int>> &uniqueDependents, Visit visit);
+
+    /**
+     * @brief Walks the cells of a range in the order a function reads them: SUM and AVER in
+     *        reading order from the first corner to the second, the others row by row over
+     *        the rectangle.
+     * @param function The function reading the range.
+     * @param firstRow The first corner, resolved.
+     * @param firstCol The first corner, resolved.
+     * @param lastRow The second corner, resolved.
+     * @param lastCol The second corner, resolved.
+     * @param step Called with the row and column of each cell; the walk stops when it returns false.
+     */
+    template <typename Step>
+    void forEachRangeCell(FunctionType function, int firstRow, int firstCol, int lastRow, int lastCol, Step step) const;
+
+    /**
+     * @brief Tells whether a function reading a range reads a cell, see forEachRangeCell.
      */
-    double MIN(std::pair<int, int> startPos, std::pair<int, int> endPos, spc::myset<std::pair<int, int>> &uniqueDependents) const;
+    bool rangeReads(const Aggregate &aggregate, std::pair<int, int> cell) const;
 };
 
 #endif
@@ -0,0 +1,541 @@
+#include "FormulaProgram.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+
+FunctionType functionNamed(std::string_view name)
+{
+    if (name == "SUM")
+        return FunctionType::SUM;
+    else if (name == "AVER")
+        return FunctionType::AVER;
+    else if (name == "STDDEV")
+        return FunctionType::STDDEV;
+    else if (name == "MAX")
+        return FunctionType::MAX;
+    else if (name == "MIN")
+        return FunctionType::MIN;
+    return FunctionType::INVALID;
+}
+
+namespace
+{
+    /**
+     * @brief The kinds of token a formula is made of.
+     */
+    enum class TokenKind
+    {
+        NUMBER, NAME, DOTS, LPAREN, RPAREN, COMMA,
+        PLUS, MINUS, STAR, SLASH, EQ, NE, LT, LE, GT, GE,
+        END, INVALID
+    };
+
+    /**
+     * @brief A token, as a view into the formula it was read from.
+     */
+    struct Token
+    {
+        TokenKind kind;
+        std::string_view text;
+    };
+
+    /**
+     * @class FormulaLexer
+     * @brief Reads the tokens of a formula one at a time, with one token of lookahead.
+     */
+    class FormulaLexer
+    {
+    public:
+        explicit FormulaLexer(std::string_view source) : source(source) { advance(); }
+
+        /** @brief The next token, without consuming it. */
+        const Token &peek() const { return current; }
+
+        /** @brief Consumes the next token. */
+        Token take()
+        {
+            Token token = current;
+            advance();
+            return token;
+        }
+
+    private:
+        std::string_view source;
+        size_t pos = 0;
+        Token current{TokenKind::END, {}};
+
+        bool digitAt(size_t i) const { return i < source.size() && isdigit(static_cast<unsigned char>(source[i])); }
+
+        void advance();
+    };
+
+    void FormulaLexer::advance()
+    {
+        while (pos < source.size() && isspace(static_cast<unsigned char>(source[pos])))
+            ++pos;
+        size_t start = pos;
+        TokenKind kind;
+
+        if (pos == source.size())
+            kind = TokenKind::END;
+        else if (digitAt(pos) || (source[pos] == '.' && digitAt(pos + 1)))
+        {
+            while (digitAt(pos))
+                ++pos;
+            // A '.' belongs to the number unless it starts a "..".
+            if (pos < source.size() && source[pos] == '.' && !(pos + 1 < source.size() && source[pos + 1] == '.'))
+            {
+                ++pos;
+                while (digitAt(pos))
+                    ++pos;
+            }
+            kind = TokenKind::NUMBER;
+        }
+        else if (isalpha(static_cast<unsigned char>(source[pos])) || source[pos] == '$')
+        {
+            while (pos < source.size() && (isalnum(static_cast<unsigned char>(source[pos])) || source[pos] == '$'))
+                ++pos;
+            kind = TokenKind::NAME;
+        }
+        else
+        {
+            char c = source[pos++];
+            char next = pos < source.size() ? source[pos] : '\0';
+            switch (c)
+            {
+            case '(': kind = TokenKind::LPAREN; break;
+            case ')': kind = TokenKind::RPAREN; break;
+            case ',': kind = TokenKind::COMMA; break;
+            case '+': kind = TokenKind::PLUS; break;
+            case '-': kind = TokenKind::MINUS; break;
+            case '*': kind = TokenKind::STAR; break;
+            case '/': kind = TokenKind::SLASH; break;
+            case '=': kind = TokenKind::EQ; break;
+            case '.':
+                kind = next == '.' ? TokenKind::DOTS : TokenKind::INVALID;
+                pos += next == '.';
+                break;
+            case '<':
+                kind = next == '=' ? TokenKind::LE : next == '>' ? TokenKind::NE : TokenKind::LT;
+                pos += next == '=' || next == '>';
+                break;
+            case '>':
+                kind = next == '=' ? TokenKind::GE : TokenKind::GT;
+                pos += next == '=';
+                break;
+            default:
+                kind = TokenKind::INVALID;
+                break;
+            }
+        }
+        current = {kind, source.substr(start, pos - start)};
+    }
+
+    /**
+     * @brief A reference relative to the cell holding the formula, as in Instruction.
+     */
+    struct Reference
+    {
+        int row = 0, col = 0;
+        bool absRow = false, absCol = false;
+    };
+
+    /**
+     * @brief Parses a reference that may anchor its column and row with '$', e.g. "$B$7".
+     * @param text The reference.
+     * @param cell Set to the (row, column) it names.
+     * @param ref Its absRow and absCol are set.
+     * @return False if the text is not a reference.
+     */
+    bool parseReference(std::string_view text, std::pair<int, int> &cell, Reference &ref)
+    {
+        char plain[32];
+        size_t length = 0;
+        ref.absRow = ref.absCol = false;
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] != '$')
+            {
+                if (length == sizeof(plain))
+                    return false;
+                plain[length++] = text[i];
+            }
+            else if (i == 0)
+                ref.absCol = true;
+            else if (!ref.absRow && isalpha(static_cast<unsigned char>(text[i - 1])) &&
+                     i + 1 < text.size() && isdigit(static_cast<unsigned char>(text[i + 1])))
+                ref.absRow = true;
+            else
+                return false;
+        }
+        cell = Cell::parseReference(std::string_view(plain, length));
+        return cell.first >= 0;
+    }
+
+    /**
+     * @brief Parses a reference token of a formula entered in a cell, relative to that cell.
+     * @return False if the token is not a reference.
+     */
+    bool relativeReference(const Token &token, int originRow, int originCol, Reference &ref)
+    {
+        std::pair<int, int> cell;
+        if (token.kind != TokenKind::NAME || !parseReference(token.text, cell, ref))
+            return false;
+        ref.row = ref.absRow ? cell.first : cell.first - originRow;
+        ref.col = ref.absCol ? cell.second : cell.second - originCol;
+        return true;
+    }
+
+    /**
+     * @brief Appends one coordinate of a reference in R1C1 notation: "R7" if anchored, else "R[-1]".
+     */
+    void appendR1C1(std::string &out, char axis, int value, bool anchored)
+    {
+        char digits[16];
+        char *end = std::to_chars(digits, digits + sizeof(digits), anchored ? value + 1 : value).ptr;
+        out += axis;
+        if (!anchored)
+            out += '[';
+        out.append(digits, end);
+        if (!anchored)
+            out += ']';
+    }
+
+    /**
+     * @class FormulaCompiler
+     * @brief Compiles a formula by precedence climbing, emitting each operator once its
+     *        operands are emitted.
+     */
+    class FormulaCompiler
+    {
+    public:
+        /**
+         * @param formula The formula, starting with '='.
+         * @param row The row of the cell holding it; references are compiled relative to it.
+         * @param col The column of the cell holding it.
+         * @param text Receives the text of the template.
+         */
+        FormulaCompiler(std::string_view formula, int row, int col, std::string &text)
+            : formula(formula), lexer(formula.substr(1)), originRow(row), originCol(col), text(text) {}
+
+        FormulaProgram compile();
+
+        bool failed() const { return failure != CellError::NONE; }
+
+    private:
+        /** @brief Deepest nesting of parentheses, unary operators and calls accepted. */
+        static constexpr int MAX_NESTING = 256;
+
+        std::string_view formula;
+        FormulaLexer lexer;
+        int originRow, originCol;
+        std::string &text;
+        size_t copied = 0;                   ///< Length of the formula already copied to text.
+        FormulaProgram program;
+        size_t depth = 0;                    ///< Operands on the stack at this point of the program.
+        int nesting = 0;                     ///< Current recursion depth of unary(), which every nesting passes.
+        CellError failure = CellError::NONE; ///< The first error met; the rest of the formula is skipped.
+
+        void fail(CellError error)
+        {
+            if (!failed())
+                failure = error;
+        }
+
+        void emit(const Instruction &instruction, int stackEffect)
+        {
+            program.code.push_back(instruction);
+            depth += stackEffect;
+            program.maxDepth = std::max(program.maxDepth, depth);
+        }
+
+        /**
+         * @brief Compiles operators binding at least as tightly as minPrecedence, and their operands.
+         * @return True if the expression is a bare range, which only a function accepts.
+         */
+        bool expression(int minPrecedence);
+
+        bool unary();
+        bool primary();
+        void call(std::string_view name);
+
+        /**
+         * @brief Parses a reference token relative to the cell, and writes its mark to text.
+         * @return False if the token is not a reference.
+         */
+        bool reference(const Token &token, Reference &ref);
+    };
+
+    /**
+     * @brief Tells the precedence of a binary operator token, and its instruction.
+     * @return 0 if the token is not a binary operator.
+     */
+    int binaryOperator(TokenKind kind, OpCode &op)
+    {
+        switch (kind)
+        {
+        case TokenKind::EQ: op = OpCode::EQ; return 1;
+        case TokenKind::NE: op = OpCode::NE; return 1;
+        case TokenKind::LT: op = OpCode::LT; return 1;
+        case TokenKind::LE: op = OpCode::LE; return 1;
+        case TokenKind::GT: op = OpCode::GT; return 1;
+        case TokenKind::GE: op = OpCode::GE; return 1;
+        case TokenKind::PLUS: op = OpCode::ADD; return 2;
+        case TokenKind::MINUS: op = OpCode::SUB; return 2;
+        case TokenKind::STAR: op = OpCode::MUL; return 3;
+        case TokenKind::SLASH: op = OpCode::DIV; return 3;
+        default: return 0;
+        }
+    }
+
+    FormulaProgram FormulaCompiler::compile()
+    {
+        // Every token emits at most one instruction: counting them first sizes the program exactly once.
+        size_t tokens = 0;
+        for (FormulaLexer counter(formula); counter.peek().kind != TokenKind::END; counter.take())
+            ++tokens;
+        program.code.reserve(tokens + 1);
+        text.reserve(formula.size());
+
+        if (expression(1))
+            fail(CellError::VALUE); // A range on its own has no value
+        if (lexer.peek().kind != TokenKind::END)
+            fail(CellError::VALUE);
+
+        text.append(formula.substr(copied));
+        if (failed())
+        {
+            text.assign(formula); // Kept verbatim
+            program.code.clear();
+            program.code.push_back({OpCode::ERROR});
+            program.code.back().error = failure;
+            program.maxDepth = 1;
+        }
+        return std::move(program);
+    }
+
+    bool FormulaCompiler::expression(int minPrecedence)
+    {
+        bool isRange = unary();
+        OpCode op;
+        int precedence;
+        while (!failed() && (precedence = binaryOperator(lexer.peek().kind, op)) >= minPrecedence && precedence > 0)
+        {
+            lexer.take();
+            if (isRange || expression(precedence + 1))
+                fail(CellError::VALUE);
+            emit({op}, -1);
+            isRange = false;
+        }
+        return isRange;
+    }
+
+    bool FormulaCompiler::unary()
+    {
+        if (nesting == MAX_NESTING)
+            fail(CellError::VALUE);
+        if (failed())
+            return false;
+
+        ++nesting;
+        bool isRange = false;
+        TokenKind kind = lexer.peek().kind;
+        if (kind == TokenKind::PLUS || kind == TokenKind::MINUS)
+        {
+            lexer.take();
+            if (unary())
+                fail(CellError::VALUE);
+            if (kind == TokenKind::MINUS)
+                emit({OpCode::NEG}, 0);
+        }
+        else
+            isRange = primary();
+        --nesting;
+        return isRange;
+    }
+
+    bool FormulaCompiler::primary()
+    {
+        Token token = lexer.take();
+        switch (token.kind)
+        {
+        case TokenKind::NUMBER:
+        {
+            Instruction instruction{OpCode::NUMBER};
+            auto [end, ec] = std::from_chars(token.text.data(), token.text.data() + token.text.size(), instruction.number);
+            if (ec != std::errc() || end != token.text.data() + token.text.size())
+                fail(CellError::VALUE);
+            emit(instruction, 1);
+            return false;
+        }
+        case TokenKind::NAME:
+        {
+            if (lexer.peek().kind == TokenKind::LPAREN)
+            {
+                call(token.text);
+                return false;
+            }
+            Reference first;
+            if (!reference(token, first))
+            {
+                fail(CellError::NAME);
+                return false;
+            }
+            if (lexer.peek().kind != TokenKind::DOTS)
+            {
+                Instruction instruction{OpCode::CELL};
+                instruction.row = first.row;
+                instruction.col = first.col;
+                instruction.absRow = first.absRow;
+                instruction.absCol = first.absCol;
+                emit(instruction, 1);
+                return false;
+            }
+
+            lexer.take();
+            Reference second;
+            if (!reference(lexer.take(), second))
+            {
+                fail(CellError::VALUE);
+                return false;
+            }
+            Instruction instruction{OpCode::RANGE};
+            instruction.row = first.row;
+            instruction.col = first.col;
+            instruction.absRow = first.absRow;
+            instruction.absCol = first.absCol;
+            instruction.endRow = second.row;
+            instruction.endCol = second.col;
+            instruction.endAbsRow = second.absRow;
+            instruction.endAbsCol = second.absCol;
+            emit(instruction, 1);
+            return true;
+        }
+        case TokenKind::LPAREN:
+        {
+            bool isRange = expression(1);
+            if (lexer.take().kind != TokenKind::RPAREN)
+                fail(CellError::VALUE);
+            return isRange;
+        }
+        default:
+            fail(CellError::VALUE);
+            return false;
+        }
+    }
+
+    bool FormulaCompiler::reference(const Token &token, Reference &ref)
+    {
+        if (!relativeReference(token, originRow, originCol, ref))
+            return false;
+
+        size_t begin = static_cast<size_t>(token.text.data() - formula.data());
+        text.append(formula.substr(copied, begin - copied)).push_back(FormulaTemplate::REFERENCE_MARK);
+        copied = begin + token.text.size();
+        return true;
+    }
+
+    void FormulaCompiler::call(std::string_view name)
+    {
+        Instruction instruction{OpCode::CALL};
+        instruction.function = functionNamed(name);
+        if (instruction.function == FunctionType::INVALID)
+        {
+            fail(CellError::NAME);
+            return;
+        }
+
+        lexer.take(); // (
+        while (true)
+        {
+            expression(1); // Ranges are welcome here
+            ++instruction.argc;
+            if (failed() || lexer.peek().kind != TokenKind::COMMA)
+                break;
+            lexer.take();
+        }
+
+        if (lexer.take().kind != TokenKind::RPAREN)
+            fail(CellError::VALUE);
+        emit(instruction, 1 - instruction.argc);
+    }
+}
+
+FormulaTemplate compileTemplate(std::string_view formula, int row, int col)
+{
+    FormulaTemplate result;
+    if (formula.empty())
+        return result; // Not a formula; the caller checks for the '='
+    result.program = FormulaCompiler(formula, row, col, result.text).compile();
+    return result;
+}
+
+void templateKey(std::string_view formula, int row, int col, std::string &key)
+{
+    key.clear();
+    if (formula.empty())
+        return;
+
+    // Every name not calling a function is a reference in a formula that compiles.
+    size_t copied = 0;
+    for (FormulaLexer lexer(formula.substr(1)); lexer.peek().kind != TokenKind::END;)
+    {
+        Token token = lexer.take();
+        Reference ref;
+        if (lexer.peek().kind == TokenKind::LPAREN || !relativeReference(token, row, col, ref))
+            continue;
+
+        size_t begin = static_cast<size_t>(token.text.data() - formula.data());
+        key.append(formula.substr(copied, begin - copied));
+        appendR1C1(key, 'R', ref.row, ref.absRow);
+        appendR1C1(key, 'C', ref.col, ref.absCol);
+        copied = begin + token.text.size();
+    }
+    key.append(formula.substr(copied));
+}
+
+std::string FormulaTemplate::render(int row, int col) const
+{
+    // The references come in the order of the instructions: one per CELL, two per RANGE.
+    auto next = program.code.begin();
+    bool secondCorner = false;
+
+    std::string out;
+    out.reserve(text.size() + 16);
+    for (char c : text)
+    {
+        while (!secondCorner && next != program.code.end() && next->op != OpCode::CELL && next->op != OpCode::RANGE)
+            ++next;
+        if (c != REFERENCE_MARK || next == program.code.end())
+        {
+            out += c;
+            continue;
+        }
+
+        int refRow = secondCorner ? next->endRow : next->row;
+        int refCol = secondCorner ? next->endCol : next->col;
+        bool absRow = secondCorner ? next->endAbsRow : next->absRow;
+        bool absCol = secondCorner ? next->endAbsCol : next->absCol;
+        if (absCol)
+            out += '$';
+        Cell::appendColumnLetters(out, absCol ? refCol : col + refCol);
+        if (absRow)
+            out += '$';
+        out += std::to_string((absRow ? refRow : row + refRow) + 1);
+
+        if (next->op == OpCode::RANGE && !secondCorner)
+            secondCorner = true;
+        else
+        {
+            secondCorner = false;
+            ++next;
+        }
+    }
+    return out;
+}
+
+size_t FormulaTemplate::memoryUsage() const
+{
+    return sizeof(FormulaTemplate) + (text.capacity() > 15 ? text.capacity() + 1 : 0) +
+           program.code.capacity() * sizeof(Instruction);
+}
@@ -0,0 +1,161 @@
+#ifndef FORMULA_PROGRAM_H
+#define FORMULA_PROGRAM_H
+
+#include "Cell.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @enum FunctionType
+ * @brief Represents the types of functions that can be parsed and evaluated.
+ */
+enum class FunctionType
+{
+    SUM,    ///< Sum of values in a range.
+    AVER,   ///< Average of values in a range.
+    STDDEV, ///< Standard deviation of values in a range.
+    MAX,    ///< Maximum value in a range.
+    MIN,    ///< Minimum value in a range.
+    INVALID ///< Invalid function type.
+};
+
+/**
+ * @brief Looks up a function by name.
+ * @param name The name, e.g. "SUM".
+ * @return The corresponding FunctionType, or INVALID if there is no such function.
+ */
+FunctionType functionNamed(std::string_view name);
+
+/**
+ * @enum OpCode
+ * @brief The operations of a compiled formula.
+ */
+enum class OpCode : uint8_t
+{
+    NUMBER, ///< Pushes number.
+    CELL,   ///< Pushes the value of the cell at (row, col), see Instruction.
+    RANGE,  ///< Pushes the range (row, col)..(endRow, endCol); only valid as a function argument.
+    NEG,    ///< Negates the top of the stack.
+    ADD,    ///< Pops b, a and pushes a + b; likewise for the other binary operators.
+    SUB,    ///< a - b
+    MUL,    ///< a * b
+    DIV,    ///< a / b, or #DIV/0!
+    EQ,     ///< 1 if a = b, else 0; likewise for the other comparisons.
+    NE,     ///< a <> b
+    LT,     ///< a < b
+    LE,     ///< a <= b
+    GT,     ///< a > b
+    GE,     ///< a >= b
+    CALL,   ///< Pops argc arguments and pushes the result of function.
+    ERROR   ///< Pushes error; the formula failed to compile.
+};
+
+/**
+ * @struct Instruction
+ * @brief One operation of a compiled formula.
+ *
+ * References are relative to the cell holding the formula: a row or column is an
+ * offset from the cell's own, unless it was anchored with '$' (as in $A$1), in which
+ * case it is the coordinate itself.
+ */
+struct Instruction
+{
+    OpCode op;                                  ///< What to do.
+    FunctionType function = FunctionType::INVALID; ///< The function, for CALL.
+    CellError error = CellError::NONE;          ///< The error, for ERROR.
+    bool absRow = false, absCol = false;        ///< Whether row and col are anchored.
+    bool endAbsRow = false, endAbsCol = false;  ///< Whether endRow and endCol are anchored.
+    int argc = 0;                               ///< The number of arguments, for CALL.
+    int row = 0, col = 0;                       ///< The cell, for CELL, or the first corner, for RANGE.
+    int endRow = 0, endCol = 0;                 ///< The second corner, for RANGE.
+    double number = 0.0;                        ///< The constant, for NUMBER.
+};
+
+/**
+ * @struct FormulaProgram
+ * @brief A formula compiled to postfix order: evaluating it is one pass over the
+ *        instructions with a stack of operands.
+ */
+struct FormulaProgram
+{
+    std::vector<Instruction> code; ///< The instructions, operands before their operator.
+    size_t maxDepth = 0;           ///< The deepest the operand stack gets.
+};
+
+/**
+ * @struct FormulaTemplate
+ * @brief A compiled formula that does not depend on the cell holding it.
+ *
+ * Filling a formula down a column, e.g. =A1*B1, =A2*B2, ..., gives the same template in
+ * every row: the program refers to "this row, two columns left" rather than to A1.
+ * Cells holding the same formula share one template, and a cell recovers its own text
+ * by rendering the template at its position.
+ */
+struct FormulaTemplate
+{
+    /** @brief Marks where a reference goes in text; no formula that compiles contains it. */
+    static constexpr char REFERENCE_MARK = '\x1f';
+
+    /**
+     * @brief The formula with each reference replaced by REFERENCE_MARK. The references are
+     *        those of the CELL and RANGE instructions of the program, which are in the same order.
+     */
+    std::string text;
+    FormulaProgram program; ///< The compiled formula.
+
+    /**
+     * @brief Writes the formula as entered in a given cell.
+     * @param row The row of the cell.
+     * @param col The column of the cell.
+     * @return The formula with its references in the letter representation.
+     */
+    std::string render(int row, int col) const;
+
+    /**
+     * @brief Estimates the memory used by the template.
+     * @return Size in bytes.
+     */
+    size_t memoryUsage() const;
+};
+
+/**
+ * @brief Compiles a formula entered in a cell.
+ *
+ * The grammar, from the loosest binding operators to the tightest:
+ *
+ *     comparison  :=  sum (("=" | "<>" | "<" | "<=" | ">" | ">=") sum)*
+ *     sum         :=  product (("+" | "-") product)*
+ *     product     :=  unary (("*" | "/") unary)*
+ *     unary       :=  ("+" | "-") unary | primary
+ *     primary     :=  number | reference | NAME "(" [argument ("," argument)*] ")" | "(" comparison ")"
+ *     argument    :=  reference ".." reference | comparison
+ *     reference   :=  ["$"] letters ["$"] digits
+ *
+ * Binary operators associate to the left; spaces between tokens are ignored. The formula
+ * is lexed twice, once to count its tokens so the program is sized exactly and once to
+ * compile it; the only allocations are the program's instructions and the template text.
+ * @param formula The formula, starting with '='.
+ * @param row The row of the cell.
+ * @param col The column of the cell.
+ * @return The template. A formula that does not parse compiles to a single ERROR
+ *         instruction, #NAME? for an unknown function or name and #VALUE! otherwise,
+ *         and keeps its text as it is.
+ */
+FormulaTemplate compileTemplate(std::string_view formula, int row, int col);
+
+/**
+ * @brief Writes the key under which the template of a formula is shared without compiling
+ *        it: the formula with its references in R1C1 notation, e.g. "=R[0]C[-2]*R[0]C[-1]"
+ *        for =A1*B1 entered in C1. Formulas that compile and have equal keys compile to
+ *        equal templates; one that does not compile keeps its own text, so its key says
+ *        nothing about its template. Allocates nothing once key is large enough.
+ * @param formula The formula, starting with '='.
+ * @param row The row of the cell.
+ * @param col The column of the cell.
+ * @param key Set to the key.
+ */
+void templateKey(std::string_view formula, int row, int col, std::string &key);
+
+#endif
@@ -0,0 +1,97 @@
+#include "RecalcEngine.h"
+#include <vector>
+#include <chrono>
+
+RecalcEngine::RecalcEngine(FormulaParser &parser, std::mutex &sheetMutex)
+    : parser(parser), sheetMutex(sheetMutex), worker(&RecalcEngine::workerLoop, this)
+{
+}
+
+RecalcEngine::~RecalcEngine()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void RecalcEngine::schedule(std::pair<int, int> cell)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        roots.insert(cell);
+        ++generation;
+    }
+    wake.notify_one();
+}
+
+bool RecalcEngine::isIdle() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return roots.empty() && !running;
+}
+
+void RecalcEngine::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return roots.empty() && !running; });
+}
+
+void RecalcEngine::workerLoop()
+{
+    while (true)
+    {
+        std::set<std::pair<int, int>> batch;
+        uint64_t startedAt;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !roots.empty(); });
+            if (roots.empty())
+                return; // stopping, and every edit has been recalculated
+
+            batch.swap(roots);
+            running = true;
+            startedAt = generation;
+        }
+
+        auto passStart = std::chrono::steady_clock::now();
+
+        // The batch holds every outstanding edit, so its plan is exactly what is stale.
+        RecalcPlan plan;
+        {
+            std::lock_guard<std::mutex> lock(sheetMutex);
+            plan = parser.planRecalculation(batch);
+            pending.clear();
+            pending.insert(plan.cells.begin(), plan.cells.end());
+        }
+
+        bool superseded = false;
+        for (size_t i = 0; i < plan.cells.size(); ++i)
+        {
+            if (generation != startedAt)
+            {
+                superseded = true;
+                break;
+            }
+            std::lock_guard<std::mutex> lock(sheetMutex);
+            parser.recalculateCell(plan.cells[i], plan.onCycle(i));
+            pending.erase(plan.cells[i]);
+        }
+
+        if (!superseded)
+        {
+            std::lock_guard<std::mutex> lock(sheetMutex);
+            lastPassMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - passStart).count();
+            lastPassCells = plan.cells.size();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (superseded)
+            roots.insert(batch.begin(), batch.end()); // Replanned together with the new edits
+        running = false;
+        if (roots.empty())
+            idle.notify_all();
+    }
+}
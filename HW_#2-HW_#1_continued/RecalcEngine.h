@@ -0,0 +1,99 @@
+#ifndef RECALC_ENGINE_H
+#define RECALC_ENGINE_H
+
+#include "FormulaParser.h"
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @class RecalcEngine
+ * @brief Recalculates the dependents of edited cells on a background thread.
+ *
+ * Edits are scheduled with schedule() and return immediately. The worker plans
+ * a pass over every outstanding edit, marks the affected cells as pending and
+ * evaluates them one at a time, holding the sheet mutex only for a single cell,
+ * so the interface can keep drawing in between. A new edit supersedes the pass
+ * in flight: the worker abandons it and starts a new pass covering both.
+ */
+class RecalcEngine
+{
+public:
+    /**
+     * @brief Starts the worker thread.
+     * @param parser The parser of the spreadsheet to recalculate.
+     * @param sheetMutex The mutex guarding the cells of the spreadsheet.
+     */
+    RecalcEngine(FormulaParser &parser, std::mutex &sheetMutex);
+
+    /**
+     * @brief Destructor: finishes the outstanding work, then joins the worker.
+     */
+    ~RecalcEngine();
+
+    RecalcEngine(const RecalcEngine &) = delete;
+    RecalcEngine &operator=(const RecalcEngine &) = delete;
+
+    /**
+     * @brief Queues recalculation of the dependents of a cell, superseding the pass in flight.
+     * @param cell The coordinates of the edited cell.
+     */
+    void schedule(std::pair<int, int> cell);
+
+    /**
+     * @brief Tells whether every scheduled edit has been fully recalculated.
+     * @return True if there is nothing queued and no pass running.
+     */
+    bool isIdle() const;
+
+    /**
+     * @brief Blocks until every scheduled edit has been fully recalculated.
+     */
+    void waitIdle();
+
+    /**
+     * @brief Tells whether a cell still waits for recalculation. The caller must hold the sheet mutex.
+     * @param cell The coordinates of the cell.
+     * @return True if the cell's displayed value is stale.
+     */
+    bool isPending(std::pair<int, int> cell) const { return pending.count(cell) != 0; }
+
+    /**
+     * @brief Returns how long the last completed pass took. The caller must hold the sheet mutex.
+     * @return The duration in milliseconds, planning included.
+     */
+    double getLastPassMillis() const { return lastPassMillis; }
+
+    /**
+     * @brief Returns how many formulas the last completed pass evaluated. The caller must hold the sheet mutex.
+     * @return The number of formula cells.
+     */
+    size_t getLastPassCells() const { return lastPassCells; }
+
+private:
+    FormulaParser &parser;                    ///< Evaluates the formulas.
+    std::mutex &sheetMutex;                   ///< Guards the cells, pending and the pass statistics.
+    std::set<std::pair<int, int>> pending;    ///< Cells planned but not evaluated yet.
+    double lastPassMillis = 0;                ///< Duration of the last completed pass.
+    size_t lastPassCells = 0;                 ///< Formulas evaluated by the last completed pass.
+
+    mutable std::mutex mutex;                 ///< Guards roots, running and stopping.
+    std::condition_variable wake;             ///< Signalled when work is queued or on shutdown.
+    std::condition_variable idle;             ///< Signalled when the engine runs out of work.
+    std::set<std::pair<int, int>> roots;      ///< Edited cells not covered by a finished pass.
+    bool running = false;                     ///< Whether a pass is in progress.
+    bool stopping = false;                    ///< Set by the destructor.
+    std::atomic<uint64_t> generation{0};      ///< Incremented by every schedule().
+
+    std::thread worker;                       ///< The recalculation thread; started last.
+
+    /**
+     * @brief The loop executed by the worker thread.
+     */
+    void workerLoop();
+};
+
+#endif
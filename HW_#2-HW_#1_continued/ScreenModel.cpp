@@ -0,0 +1,91 @@
+#include "ScreenModel.h"
+#include <algorithm>
+
+namespace
+{
+    char charAt(const std::string &s, int i, char blank)
+    {
+        return i < static_cast<int>(s.size()) ? s[i] : blank;
+    }
+}
+
+void ScreenModel::put(int row, int col, const std::string &text, bool inverted)
+{
+    if (row < 1 || col < 1)
+        return;
+    if (static_cast<int>(current.size()) < row)
+        current.resize(row);
+
+    Line &line = current[row - 1];
+    size_t end = col - 1 + text.size();
+    if (line.text.size() < end)
+    {
+        line.text.resize(end, ' ');
+        line.inverse.resize(end, '0');
+    }
+    line.text.replace(col - 1, text.size(), text);
+    line.inverse.replace(col - 1, text.size(), text.size(), inverted ? '1' : '0');
+}
+
+void ScreenModel::present(AnsiTerminal &terminal)
+{
+    terminal.beginFrame();
+    if (fullRedraw)
+    {
+        terminal.queueClearScreen();
+        previous.clear();
+        fullRedraw = false;
+    }
+
+    const Line blank;
+    int rows = static_cast<int>(std::max(current.size(), previous.size()));
+    for (int r = 0; r < rows; ++r)
+    {
+        const Line &now = r < static_cast<int>(current.size()) ? current[r] : blank;
+        const Line &old = r < static_cast<int>(previous.size()) ? previous[r] : blank;
+        int length = static_cast<int>(std::max(now.text.size(), old.text.size()));
+
+        auto differs = [&](int i) {
+            return charAt(now.text, i, ' ') != charAt(old.text, i, ' ') ||
+                   charAt(now.inverse, i, '0') != charAt(old.inverse, i, '0');
+        };
+
+        for (int i = 0; i < length; ++i)
+        {
+            if (!differs(i))
+                continue;
+
+            // Extend the run over short stretches of unchanged text; repositioning costs more.
+            int last = i;
+            for (int j = i + 1; j < length && j - last < MIN_SKIP; ++j)
+                if (differs(j))
+                    last = j;
+
+            drawRun(terminal, r, now, i, last + 1);
+            i = last;
+        }
+    }
+
+    terminal.endFrame();
+
+    previous = std::move(current);
+    current.clear();
+}
+
+void ScreenModel::drawRun(AnsiTerminal &terminal, int row, const Line &line, int from, int to)
+{
+    while (from < to)
+    {
+        char attribute = charAt(line.inverse, from, '0');
+        int end = from;
+        std::string text;
+        while (end < to && charAt(line.inverse, end, '0') == attribute)
+            text += charAt(line.text, end++, ' ');
+
+        if (attribute == '1')
+            terminal.queueInvertedAt(row + 1, from + 1, text);
+        else
+            terminal.queueAt(row + 1, from + 1, text);
+        from = end;
+    }
+}
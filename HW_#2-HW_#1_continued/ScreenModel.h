@@ -0,0 +1,70 @@
+#ifndef SCREEN_MODEL_H
+#define SCREEN_MODEL_H
+
+#include "AnsiTerminal.h"
+#include <string>
+#include <vector>
+
+/**
+ * @class ScreenModel
+ * @brief Remembers the frame last drawn on the terminal and redraws only what changed.
+ *
+ * A frame is composed with put() and sent with present(), which compares it to the
+ * previous frame character by character and prints only the runs that differ.
+ * Moving the cursor therefore repaints two cells, and an edit repaints the edited
+ * cell, its dependents and the status lines, instead of the whole screen.
+ */
+class ScreenModel
+{
+public:
+    /**
+     * @brief Places text into the frame being composed, overwriting what is there.
+     * @param row The row position (1-based, as in AnsiTerminal::printAt).
+     * @param col The column position (1-based).
+     * @param text The text to place.
+     * @param inverted Whether the text is shown with inverted colors.
+     */
+    void put(int row, int col, const std::string &text, bool inverted = false);
+
+    /**
+     * @brief Draws the differences between the composed frame and the previous one
+     *        as a single terminal frame, then starts composing the next frame from an empty screen.
+     * @param terminal The terminal to draw on.
+     */
+    void present(AnsiTerminal &terminal);
+
+    /**
+     * @brief Makes the next present() clear the screen and draw the whole frame,
+     *        e.g. because something else has written to the terminal.
+     */
+    void invalidate() { fullRedraw = true; }
+
+private:
+    /**
+     * @brief One line of a frame: its characters and, per character, whether it is inverted.
+     */
+    struct Line
+    {
+        std::string text;     ///< The characters of the line.
+        std::string inverse;  ///< '1' for every inverted character, '0' otherwise.
+    };
+
+    /** @brief Unchanged characters shorter than this between two changes are redrawn rather than skipped. */
+    static constexpr int MIN_SKIP = 8;
+
+    std::vector<Line> previous;  ///< The frame currently on the terminal.
+    std::vector<Line> current;   ///< The frame being composed.
+    bool fullRedraw = true;      ///< Whether the terminal content is unknown.
+
+    /**
+     * @brief Queues the characters [from, to) of a line, switching attributes as needed.
+     * @param terminal The terminal to draw on.
+     * @param row The row of the line (0-based).
+     * @param line The line to print; positions past its end are printed as blanks.
+     * @param from The first column to print (0-based).
+     * @param to One past the last column to print.
+     */
+    void drawRun(AnsiTerminal &terminal, int row, const Line &line, int from, int to);
+};
+
+#endif
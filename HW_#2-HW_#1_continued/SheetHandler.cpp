@@ -1,7 +1,9 @@
 #include "SheetHandler.h"
 #include <filesystem>
+#include <algorithm>
+#include <vector>
 
-SheetHandler::SheetHandler(const std::string &dirPath)
+SheetHandler::SheetHandler(const std::string &dirPath, bool prefetch)
     : directory_path(dirPath)
 {
     std::cout << "Initializing SheetHandler...\n";
@@ -10,85 +12,322 @@ SheetHandler::SheetHandler(const std::string &dirPath)
     {
         std::cout << "Directory " << directory_path << " does not exist. Creating it...\n";
         fs::create_directory(directory_path);
+        fs::create_directory(directory_path + "/.journal");
         return;
     }
+    fs::create_directories(directory_path + "/.journal");
 
     for (const auto &entry : fs::directory_iterator(directory_path))
     {
-        if (entry.is_regular_file())
+        // Leftovers of an interrupted save are not sheets.
+        if (entry.is_regular_file() && entry.path().extension() != ".tmp")
+            registerFile(entry);
+    }
+    std::cout << "SheetHandler initialized with " << sheets.size() << " spreadsheets.\n";
+
+    if (prefetch)
+        loadAll();
+}
+
+SheetHandler::~SheetHandler() {
+    shuttingDown = true;
+    pool.waitIdle();  // Queued tasks refer to the entries deleted below
+    for (auto &entry : sheets) {
+        delete entry.second.journal;
+        delete entry.second.sheet.load();
+    }
+}
+
+void SheetHandler::registerFile(const fs::directory_entry &file)
+{
+    std::uintmax_t size = file.file_size();
+    fs::file_time_type mtime = file.last_write_time();
+
+    std::lock_guard<std::mutex> lock(sheetsMutex);
+    auto [it, inserted] = sheets.try_emplace(file.path().filename().string());
+    if (!inserted)
+        return;  // Metadata of a registered entry is fixed; it may be loading right now
+
+    it->second.path = file.path().string();
+    it->second.size = size;
+    it->second.mtime = mtime;
+}
+
+SheetEntry &SheetHandler::findEntry(const std::string &filename)
+{
+    std::lock_guard<std::mutex> lock(sheetsMutex);
+    auto it = sheets.find(filename);
+    if (it == sheets.end())
+        throw std::invalid_argument("No spreadsheet found with the given filename.");
+    return it->second;  // Entries never move once inserted
+}
+
+Spreadsheet *SheetHandler::ensureLoaded(const std::string &filename, SheetEntry &entry, bool background)
+{
+    std::lock_guard<std::recursive_mutex> lock(entry.loadMutex);
+    Spreadsheet *sheet = entry.sheet.load();
+
+    if (!sheet)
+    {
+        if (!background)
+            std::cout << "Loading file: " << filename << "\n";
+
+        sheet = new Spreadsheet();  // Using raw pointer
+        int recovered = 0;
+        try
+        {
+            handler.loadFromFile(entry.path, *sheet);
+            recovered = openJournal(filename, entry, sheet);
+        }
+        catch (const std::exception &)
         {
-            const std::string filePath = entry.path().filename().string();
+            delete sheet;
+            throw;
+        }
+        entry.sheet = sheet;  // Published only once its journal is attached
+
+        if (recovered > 0 && !background)
+            std::cout << "Recovered " << recovered << " edits of " << filename << " from its journal.\n";
+    }
+
+    // Snapshots are only written from the menu thread.
+    if (!background && entry.journal->needsCompaction())
+        compact(entry);
+    return sheet;
+}
+
+void SheetHandler::loadAll()
+{
+    std::vector<std::pair<fs::file_time_type, std::string>> order;
+    {
+        std::lock_guard<std::mutex> lock(sheetsMutex);
+        for (const auto &[filename, entry] : sheets)
+            if (!entry.sheet.load())
+                order.push_back({entry.mtime, filename});
+    }
+    std::sort(order.begin(), order.end(), std::greater<>());
+
+    auto job = std::make_shared<BulkJob>();
+    job->name = "Load";
+    job->total = static_cast<int>(order.size());
+    job->remaining = job->total;
+    job->started = std::chrono::steady_clock::now();
+    jobs.push_back(job);
+
+    for (const auto &[mtime, filename] : order)
+    {
+        SheetEntry *entry = &findEntry(filename);
+        pool.submit([this, job, filename, entry] {
             try
             {
-                std::cout << "Loading file: " << filePath << "\n";
-                Spreadsheet* sheet = new Spreadsheet();  // Using raw pointer
-                handler.loadFromFile(entry.path().string(), *sheet);
-                sheets[filePath] = sheet;  // Store raw pointer in the map
+                if (!shuttingDown)
+                    ensureLoaded(filename, *entry, true);
             }
             catch (const std::exception &e)
             {
-                std::cout << "Error loading file " << filePath << ": " << e.what() << "\n";
+                std::lock_guard<std::mutex> lock(job->failuresMutex);
+                job->failures.push_back({filename, e.what()});
             }
+            --job->remaining;
+        });
+    }
+}
+
+void SheetHandler::saveAll()
+{
+    std::vector<std::pair<std::string, SheetEntry *>> modified;
+    {
+        std::lock_guard<std::mutex> lock(sheetsMutex);
+        for (auto &[filename, entry] : sheets)
+        {
+            Spreadsheet *sheet = entry.sheet.load();
+            if (sheet && sheet->isModified())
+                modified.push_back({filename, &entry});
         }
     }
-    std::cout << "SheetHandler initialized with " << sheets.size() << " spreadsheets.\n";
+
+    auto job = std::make_shared<BulkJob>();
+    job->name = "Save";
+    job->total = static_cast<int>(modified.size());
+    job->remaining = job->total;
+    job->started = std::chrono::steady_clock::now();
+    jobs.push_back(job);
+
+    for (const auto &[filename, entry] : modified)
+    {
+        pool.submit([this, job, filename = filename, entry = entry] {
+            try
+            {
+                compact(*entry);
+            }
+            catch (const std::exception &e)
+            {
+                std::lock_guard<std::mutex> lock(job->failuresMutex);
+                job->failures.push_back({filename, e.what()});
+            }
+            --job->remaining;
+        });
+    }
 }
 
-SheetHandler::~SheetHandler() {
-    for (auto &entry : sheets) {
-        delete entry.second;
+void SheetHandler::waitForBulkJobs()
+{
+    pool.waitIdle();
+}
+
+void SheetHandler::reportBulkJobs()
+{
+    for (auto it = jobs.begin(); it != jobs.end();)
+    {
+        BulkJob &job = **it;
+        if (job.remaining > 0)
+        {
+            ++it;
+            continue;
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - job.started);
+        std::cout << job.name << " of " << job.total << " sheets finished in about "
+                  << elapsed.count() << " ms, " << job.failures.size() << " failed.\n";
+        for (const auto &[filename, message] : job.failures)
+            std::cout << "  " << filename << ": " << message << "\n";
+
+        it = jobs.erase(it);
+    }
+}
+
+std::string SheetHandler::journalPath(const std::string &filename) const
+{
+    return directory_path + "/.journal/" + filename + ".wal";
+}
+
+int SheetHandler::openJournal(const std::string &filename, SheetEntry &entry, Spreadsheet *sheet)
+{
+    if (!entry.journal)
+        entry.journal = new EditJournal(journalPath(filename));
+
+    int recovered = entry.journal->replay(*sheet);
+    sheet->attachJournal(entry.journal);
+    return recovered;
+}
+
+void SheetHandler::compact(SheetEntry &entry)
+{
+    std::lock_guard<std::recursive_mutex> lock(entry.loadMutex);
+    Spreadsheet *sheet = entry.sheet.load();
+    handler.saveChanges(entry.path, *sheet);
+    if (entry.journal)
+        entry.journal->truncate();
+    sheet->setModified(false);
+}
+
+void SheetHandler::revert(const std::string &filename, SheetEntry &entry)
+{
+    std::lock_guard<std::recursive_mutex> lock(entry.loadMutex);
+
+    Spreadsheet *fresh = new Spreadsheet();  // Using raw pointer
+    try
+    {
+        handler.loadFromFile(entry.path, *fresh);
+        if (!entry.journal)
+            entry.journal = new EditJournal(journalPath(filename));
+        entry.journal->truncate();
+    }
+    catch (const std::exception &)
+    {
+        delete fresh;
+        throw;
     }
+    fresh->attachJournal(entry.journal);
+    delete entry.sheet.exchange(fresh);
 }
 
 void SheetHandler::add(const std::string &filename, Spreadsheet* newSheet)
 {
     if (newSheet)
     {
-        sheets[filename] = newSheet;  // Store raw pointer
-        handler.saveToFile(directory_path + "/" + filename, *newSheet);
+        std::string fullPath = directory_path + "/" + filename;
+        handler.saveChanges(fullPath, *newSheet);
+        registerFile(fs::directory_entry(fullPath));
+
+        SheetEntry &entry = findEntry(filename);
+        std::lock_guard<std::recursive_mutex> lock(entry.loadMutex);
+        delete entry.sheet.exchange(newSheet);  // Store raw pointer
+
+        // A journal left behind by an earlier sheet of the same name must not be replayed.
+        if (!entry.journal)
+        {
+            fs::remove(journalPath(filename));
+            entry.journal = new EditJournal(journalPath(filename));
+        }
+        entry.journal->truncate();
+        newSheet->attachJournal(entry.journal);
     }
 }
 
 void SheetHandler::saveSheet(const std::string &filename)
 {
-    if (sheets.find(filename) == sheets.end())
-        throw std::invalid_argument("No spreadsheet found with the given filename.");
-
-    Spreadsheet* sheet = sheets[filename];
-    std::string fullPath = directory_path + "/" + filename;
-    handler.saveToFile(fullPath, *sheet);
+    SheetEntry &entry = findEntry(filename);
+    ensureLoaded(filename, entry, false);
+    compact(entry);
     std::cout << "Spreadsheet saved successfully as " << filename << "\n";
 }
 
 void SheetHandler::loadSheet(const std::string &filename)
 {
-    if (sheets.find(filename) != sheets.end())
+    std::string fullPath = directory_path + "/" + filename;
+    bool registered;
     {
-        std::cout << "A spreadsheet with this filename is already loaded.\n";
-        return;
+        std::lock_guard<std::mutex> lock(sheetsMutex);
+        auto it = sheets.find(filename);
+        if (it != sheets.end() && it->second.sheet.load())
+        {
+            std::cout << "A spreadsheet with this filename is already loaded.\n";
+            return;
+        }
+        registered = it != sheets.end();
     }
 
-    Spreadsheet* newSheet = new Spreadsheet();  // Using raw pointer
-    std::string fullPath = directory_path + "/" + filename;
-    handler.loadFromFile(fullPath, *newSheet);
-    sheets[filename] = newSheet;  // Store raw pointer
+    if (!registered)
+    {
+        if (!fs::is_regular_file(fullPath))
+            throw std::runtime_error("File error");
+        registerFile(fs::directory_entry(fullPath));
+    }
+
+    try
+    {
+        ensureLoaded(filename, findEntry(filename), false);
+    }
+    catch (const std::exception &)
+    {
+        // A file that fails to load must not stay registered; only this thread knows the new entry.
+        if (!registered)
+        {
+            std::lock_guard<std::mutex> lock(sheetsMutex);
+            auto it = sheets.find(filename);
+            delete it->second.journal;
+            sheets.erase(it);
+        }
+        throw;
+    }
     std::cout << "Spreadsheet loaded successfully from " << filename << "\n";
 }
 
-Spreadsheet* SheetHandler::getSheet(const std::string &filename) const
+Spreadsheet* SheetHandler::getSheet(const std::string &filename)
 {
-    auto it = sheets.find(filename);
-    if (it == sheets.end())
-        throw std::invalid_argument("No spreadsheet found with the given filename.");
-    return it->second;  // Return raw pointer
+    return ensureLoaded(filename, findEntry(filename), false);  // Return raw pointer
 }
 
 void SheetHandler::viewSavedSheets() const
 {
+    std::lock_guard<std::mutex> lock(sheetsMutex);
     std::cout << "\n--- Saved Sheets ---\n";
-    for (const auto &[filename, sheet] : sheets)
+    for (const auto &[filename, entry] : sheets)
     {
-        std::cout << filename << "\n";
+        std::cout << filename << " (" << entry.size << " bytes"
+                  << (entry.sheet.load() ? ", loaded" : "") << ")\n";
     }
 }
 
@@ -99,6 +338,8 @@ void SheetHandler::displayMenu() const
     std::cout << "2. Run sheet\n";
     std::cout << "3. View saved sheets\n";
     std::cout << "4. Exit\n";
+    std::cout << "5. Load all sheets in the background\n";
+    std::cout << "6. Save all modified sheets in the background\n";
     std::cout << "Enter your choice: ";
 }
 
@@ -108,6 +349,7 @@ void SheetHandler::runMenu()
 
     do
     {
+        reportBulkJobs();
         displayMenu();
         std::getline(std::cin, choice);
 
@@ -123,8 +365,21 @@ void SheetHandler::runMenu()
             viewSavedSheets();
             break;
         case 4:
+            // Pending loads may still bring in recovered edits; then modified sheets are saved concurrently.
+            waitForBulkJobs();
+            saveAll();
+            waitForBulkJobs();
+            reportBulkJobs();
             std::cout << "Exiting the Spreadsheet Manager. Goodbye!\n";
             break;
+        case 5:
+            loadAll();
+            std::cout << "Loading sheets in the background...\n";
+            break;
+        case 6:
+            saveAll();
+            std::cout << "Saving modified sheets in the background...\n";
+            break;
         default:
             std::cout << "Invalid choice! Please try again.\n";
             break;
@@ -158,6 +413,11 @@ void SheetHandler::handleRun()
     try
     {
         Spreadsheet* sheet = getSheet(filename);
+
+        // Keeps bulk saves of this sheet from reading it while it is being edited.
+        SheetEntry &entry = findEntry(filename);
+        std::lock_guard<std::recursive_mutex> lock(entry.loadMutex);
+        sheet = entry.sheet.load();
         sheet->run();
 
         std::string choice;
@@ -168,7 +428,7 @@ void SheetHandler::handleRun()
         {
             try
             {
-                handler.saveToFile(directory_path + "/" + filename, *sheet);  // Save the raw pointer's contents
+                compact(entry);  // Writes the snapshot and empties the journal
                 std::cout << "Sheet saved successfully!\n";
             }
             catch (const std::exception &e)
@@ -178,7 +438,15 @@ void SheetHandler::handleRun()
         }
         else
         {
-            std::cout << "Sheet was not saved.\n";
+            try
+            {
+                revert(filename, entry);
+                std::cout << "Sheet was not saved.\n";
+            }
+            catch (const std::exception &e)
+            {
+                std::cout << "Sheet was not saved, but its edits are kept in the journal: " << e.what() << "\n";
+            }
         }
     }
     catch (const std::exception &e)
@@ -3,12 +3,75 @@
 
 #include "Spreadsheet.h"
 #include "FileHandler.h"
+#include "EditJournal.h"
+#include "WorkerPool.h"
 #include <string>
 #include <unordered_map>
 #include <filesystem>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <chrono>
 
 namespace fs = std::filesystem;
 
+/**
+ * @struct SheetEntry
+ * @brief Bookkeeping for one spreadsheet known to the SheetHandler.
+ * 
+ * Entries are registered from file metadata only; the Spreadsheet itself
+ * is loaded the first time it is needed.
+ */
+struct SheetEntry
+{
+    /** @brief The full path of the sheet file. */
+    std::string path;
+
+    /** @brief The size of the sheet file in bytes when it was registered. */
+    std::uintmax_t size = 0;
+
+    /** @brief The last modification time of the sheet file when it was registered. */
+    fs::file_time_type mtime;
+
+    /** @brief The loaded spreadsheet, or nullptr while it has not been loaded yet. */
+    std::atomic<Spreadsheet*> sheet{nullptr};
+
+    /** @brief The journal attached to the loaded spreadsheet, or nullptr. */
+    EditJournal* journal = nullptr;
+
+    /**
+     * @brief Serializes loading, saving and running of this sheet.
+     *        Recursive because loading may compact, which locks it again.
+     */
+    std::recursive_mutex loadMutex;
+};
+
+/**
+ * @struct BulkJob
+ * @brief Progress and per-sheet failures of one loadAll or saveAll request.
+ */
+struct BulkJob
+{
+    /** @brief What the job does, e.g. "Load" or "Save". */
+    std::string name;
+
+    /** @brief The number of sheets the job covers. */
+    int total = 0;
+
+    /** @brief The number of sheets not processed yet. */
+    std::atomic<int> remaining{0};
+
+    /** @brief The time the job was queued. */
+    std::chrono::steady_clock::time_point started;
+
+    /** @brief The failed sheets with their error messages. */
+    std::vector<std::pair<std::string, std::string>> failures;
+
+    /** @brief Guards failures. */
+    std::mutex failuresMutex;
+};
+
 /**
  * @class SheetHandler
  * @brief A class responsible for handling multiple spreadsheets, 
@@ -19,18 +82,23 @@ namespace fs = std::filesystem;
  * and running spreadsheets through user interaction.
  * 
  * @note The spreadsheets are stored in a specified directory 
- *       (default is "sheets").
+ *       (default is "sheets"). Every committed edit is also appended 
+ *       to a per-sheet journal in its ".journal" subdirectory, which 
+ *       is replayed when the sheet is opened.
  */
 class SheetHandler
 {
 public:
     /**
      * @brief Constructs a SheetHandler object with an optional directory path.
+     *        Sheet files are only registered by their metadata; they are parsed
+     *        on first use, or on the worker pool when prefetching is enabled.
      * 
      * @param dir_path The path to the directory where sheets will be stored. 
      *                 Defaults to "sheets".
+     * @param prefetch Whether to load the registered sheets in the background.
      */
-    SheetHandler(const std::string& dir_path = "sheets");
+    SheetHandler(const std::string& dir_path = "sheets", bool prefetch = false);
 
     /**
      * @brief Adds a new spreadsheet to the handler.
@@ -55,13 +123,31 @@ public:
     void loadSheet(const std::string& filename);
 
     /**
-     * @brief Retrieves a pointer to a spreadsheet by its filename.
+     * @brief Retrieves a pointer to a spreadsheet by its filename, loading it if needed.
      * 
      * @param filename The name of the spreadsheet to retrieve.
      * 
-     * @return A pointer to the Spreadsheet object, or nullptr if not found.
+     * @return A pointer to the Spreadsheet object.
+     * @throws std::invalid_argument if no sheet with that name is registered.
+     */
+    Spreadsheet* getSheet(const std::string& filename);
+
+    /**
+     * @brief Queues every registered sheet that is not loaded yet for loading on
+     *        the worker pool, most recently modified first. Returns immediately.
+     */
+    void loadAll();
+
+    /**
+     * @brief Queues a snapshot of every loaded sheet with unsaved edits on the
+     *        worker pool. Returns immediately.
+     */
+    void saveAll();
+
+    /**
+     * @brief Blocks until every queued loadAll and saveAll task has finished.
      */
-    Spreadsheet* getSheet(const std::string& filename) const;
+    void waitForBulkJobs();
 
     /**
      * @brief Displays the list of saved spreadsheets.
@@ -79,8 +165,11 @@ public:
     ~SheetHandler();
 
 private:
-    /** @brief A map of spreadsheets indexed by their filename. */
-    std::unordered_map<std::string, Spreadsheet*> sheets;
+    /** @brief A map of registered spreadsheets indexed by their filename. */
+    std::unordered_map<std::string, SheetEntry> sheets;
+
+    /** @brief Guards the structure of the sheets map. */
+    mutable std::mutex sheetsMutex;
 
     /** @brief A FileHandler object used for managing file operations. */
     FileHandler handler;
@@ -88,6 +177,15 @@ private:
     /** @brief The path to the directory where sheets are stored. */
     const std::string directory_path;
 
+    /** @brief Bulk jobs whose results have not been reported yet. Menu thread only. */
+    std::vector<std::shared_ptr<BulkJob>> jobs;
+
+    /** @brief Tells queued load tasks to give up because the handler is shutting down. */
+    std::atomic<bool> shuttingDown{false};
+
+    /** @brief The bounded pool running loadAll and saveAll tasks. */
+    WorkerPool pool;
+
     /**
      * @brief Displays the main menu for the user to select options.
      */
@@ -102,6 +200,79 @@ private:
      * @brief Handles the execution of a selected spreadsheet.
      */
     void handleRun();
+
+    /**
+     * @brief Registers a sheet file by its metadata without loading it.
+     * 
+     * @param file The directory entry of the sheet file.
+     */
+    void registerFile(const fs::directory_entry& file);
+
+    /**
+     * @brief Looks up the entry of a registered sheet.
+     * 
+     * @param filename The name of the spreadsheet.
+     * 
+     * @return A reference to the entry.
+     * @throws std::invalid_argument if no sheet with that name is registered.
+     */
+    SheetEntry& findEntry(const std::string& filename);
+
+    /**
+     * @brief Loads the spreadsheet of an entry unless it is already loaded.
+     * 
+     * @param filename The name of the spreadsheet.
+     * @param entry The entry to load.
+     * @param background Whether the call comes from a pool worker, which loads
+     *                   silently and leaves compaction of the journal to the menu thread.
+     * 
+     * @return A pointer to the loaded Spreadsheet object.
+     */
+    Spreadsheet* ensureLoaded(const std::string& filename, SheetEntry& entry, bool background);
+
+    /**
+     * @brief Prints the outcome of every finished bulk job and forgets it.
+     */
+    void reportBulkJobs();
+
+    /**
+     * @brief Opens the journal of a spreadsheet, replays the edits it holds 
+     *        and attaches it to the sheet.
+     * 
+     * @param filename The name of the spreadsheet.
+     * @param entry The entry the journal belongs to.
+     * @param sheet The freshly loaded Spreadsheet object, not yet published in the entry.
+     * 
+     * @return The number of edits recovered from the journal.
+     */
+    int openJournal(const std::string& filename, SheetEntry& entry, Spreadsheet* sheet);
+
+    /**
+     * @brief Saves a full snapshot of a spreadsheet and empties its journal.
+     *        Holds the entry's lock, so it never overlaps a run of the same sheet.
+     * 
+     * @param entry The entry of a loaded spreadsheet.
+     */
+    void compact(SheetEntry& entry);
+
+    /**
+     * @brief Drops the unsaved edits of a spreadsheet: reloads it from its file
+     *        and empties its journal, so memory and disk agree again.
+     * 
+     * @param filename The name of the spreadsheet.
+     * @param entry The entry of a loaded spreadsheet.
+     * @throws std::runtime_error if the file cannot be reloaded; the journal is then kept.
+     */
+    void revert(const std::string& filename, SheetEntry& entry);
+
+    /**
+     * @brief Returns the path of the journal file belonging to a spreadsheet.
+     * 
+     * @param filename The name of the spreadsheet.
+     * 
+     * @return The path of the journal file.
+     */
+    std::string journalPath(const std::string& filename) const;
 };
 
 #endif
@@ -3,7 +3,10 @@
 #include "Cell.h"
 #include "myvec.h"
 #include "myset.h"
+#include "ColumnarFile.h"
+#include "RecalcEngine.h"
 #include <cctype>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <unordered_set>
@@ -12,7 +15,11 @@
 #include <string>
 
 const int COLUMN_WIDTH = 12;    // Width of each column in characters
-const int ROW_HEADER_WIDTH = 4; // Width for row headers
+const int ROW_HEADER_WIDTH = 7; // Width for row headers, up to MAX_ROWS
+const int REPAINT_MILLIS = 30;  // Repaint interval while a recalculation is running
+const int HUD_MEMORY_MILLIS = 1000; // How often the HUD re-estimates memory use
+const char HUD_TOGGLE_KEY = 20; // Ctrl+T
+const char LAZY_TOGGLE_KEY = 5; // Ctrl+E
 
 Spreadsheet::Spreadsheet(int rows, int cols)
 {
@@ -39,28 +46,37 @@ void Spreadsheet::setCell(int r, int c, std::unique_ptr<Cell> cell)
     if (r >= getRowCount() || c >= getColCount())
         throw std::out_of_range("Cell out of range.");
     cells[r][c] = std::move(cell);
+    parser->forgetDependencies({r, c});
+    if (!fullyDirty)
+        dirtyTiles.insert({r / ColumnarFile::TILE_ROWS, c});
+}
+
+void Spreadsheet::markClean()
+{
+    dirtyTiles.clear();
+    fullyDirty = false;
 }
 
 void Spreadsheet::enterData(int r, int c, std::string &input)
 {
     if (!input.empty() && input[0] == '=')
     {
-        try
-        {
-            spc::myvec<std::pair<int, int>> dependentCells;
-            double result = parser.get()->parseAndEvaluate(input, {r, c}, dependentCells);
+        // A formula that fails is kept, showing its error, so it can be fixed or its inputs corrected.
+        std::shared_ptr<const FormulaTemplate> formula = parser->compile(input, {r, c});
+        spc::myvec<std::pair<int, int>> dependentCells;
+        FormulaValue result = parser->evaluate(*formula, {r, c}, dependentCells);
 
-            setCell(r, c, std::make_unique<FormulaCell>(r, c, input));
+        setCell(r, c, std::make_unique<FormulaCell>(r, c, std::move(formula)));
 
-            auto formulaCell = dynamic_cast<FormulaCell *>(getCell(r, c));
-            formulaCell->setCalculatedValue(result);
-            for (auto &pair : dependentCells)
-                formulaCell->addDependentCell(pair);
-        }
-        catch (const std::exception &e)
-        {
-            setCell(r, c, std::make_unique<StringValueCell>(r, c, input));
-        }
+        auto formulaCell = dynamic_cast<FormulaCell *>(getCell(r, c));
+        if (result.isError())
+            formulaCell->setError(result.error);
+        else
+            formulaCell->setCalculatedValue(result.number);
+        for (auto &pair : dependentCells)
+            formulaCell->addDependentCell(pair);
+        parser->trackDependencies({r, c}, *formulaCell);
+        parser->markFresh(*formulaCell);
     }
     else
     {
@@ -88,22 +104,22 @@ void Spreadsheet::enterData(int r, int c, std::string &&input)
 {
     if (!input.empty() && input[0] == '=')
     {
-        try
-        {
-            spc::myvec<std::pair<int, int>> dependentCells;
-            double result = parser.get()->parseAndEvaluate(input, {r, c}, dependentCells);
+        // A formula that fails is kept, showing its error, so it can be fixed or its inputs corrected.
+        std::shared_ptr<const FormulaTemplate> formula = parser->compile(input, {r, c});
+        spc::myvec<std::pair<int, int>> dependentCells;
+        FormulaValue result = parser->evaluate(*formula, {r, c}, dependentCells);
 
-            setCell(r, c, std::make_unique<FormulaCell>(r, c, input));
+        setCell(r, c, std::make_unique<FormulaCell>(r, c, std::move(formula)));
 
-            auto formulaCell = dynamic_cast<FormulaCell *>(getCell(r, c));
-            formulaCell->setCalculatedValue(result);
-            for (auto &pair : dependentCells)
-                formulaCell->addDependentCell(pair);
-        }
-        catch (const std::exception &e)
-        {
-            setCell(r, c, std::make_unique<StringValueCell>(r, c, input));
-        }
+        auto formulaCell = dynamic_cast<FormulaCell *>(getCell(r, c));
+        if (result.isError())
+            formulaCell->setError(result.error);
+        else
+            formulaCell->setCalculatedValue(result.number);
+        for (auto &pair : dependentCells)
+            formulaCell->addDependentCell(pair);
+        parser->trackDependencies({r, c}, *formulaCell);
+        parser->markFresh(*formulaCell);
     }
     else
     {
@@ -127,6 +143,101 @@ void Spreadsheet::enterData(int r, int c, std::string &&input)
     }
 }
 
+void Spreadsheet::commitEdit(int r, int c, const std::string &input)
+{
+    if (r >= getRowCount() || c >= getColCount())
+        expand(std::max(r + 1, getRowCount()), std::max(c + 1, getColCount()));
+
+    enterData(r, c, std::string(input));
+    if (parser->isLazy())
+        parser->markStale({{r, c}});  // Recalculated when shown or read
+    else if (recalc)
+        recalc->schedule({r, c});  // Recalculated in the background while run() keeps drawing
+    else
+        parser.get()->autoCalculate({r, c});
+    modified = true;
+
+    if (journal)
+        journal->append(r, c, input);
+}
+
+void Spreadsheet::commitEdits(const std::vector<std::pair<std::pair<int, int>, std::string>> &edits)
+{
+    std::set<std::pair<int, int>> roots;
+    for (const auto &edit : edits)
+    {
+        int r = edit.first.first;
+        int c = edit.first.second;
+        if (r >= getRowCount() || c >= getColCount())
+            expand(std::max(r + 1, getRowCount()), std::max(c + 1, getColCount()));
+
+        enterData(r, c, std::string(edit.second));
+        roots.insert(edit.first);
+        if (journal)
+            journal->append(r, c, edit.second);
+    }
+
+    if (parser->isLazy())
+        parser->markStale(roots);
+    else
+        parser->recalculate(parser->planRecalculation(roots));
+    if (!edits.empty())
+        modified = true;
+}
+
+size_t Spreadsheet::recalculateAll()
+{
+    if (parser->isLazy())
+    {
+        parser->markAllStale();
+        return 0;
+    }
+
+    std::set<std::pair<int, int>> formulas;
+    for (int i = 0; i < getRowCount(); ++i)
+        for (int j = 0; j < getColCount(); ++j)
+            if (dynamic_cast<FormulaCell *>(getCell(i, j)))
+                formulas.insert({i, j});
+
+    // The plan orders every formula that reads another formula; the rest read only
+    // constants and go first, as a wave of their own.
+    RecalcPlan plan = parser->planRecalculation(formulas);
+    std::set<std::pair<int, int>> planned(plan.cells.begin(), plan.cells.end());
+    RecalcPlan all;
+    for (const auto &cell : formulas)
+        if (!planned.count(cell))
+            all.cells.push_back(cell);
+
+    size_t first = all.cells.size();
+    if (first > 0)
+        all.waves.push_back(0);
+    for (size_t wave : plan.waves)
+        all.waves.push_back(first + wave);
+    all.cells.insert(all.cells.end(), plan.cells.begin(), plan.cells.end());
+    all.acyclic = first + plan.acyclic;
+    all.cycleEnd = first + plan.cycleEnd;
+    parser->recalculate(all);
+    return formulas.size();
+}
+
+void Spreadsheet::setLazyEvaluation(bool lazy)
+{
+    // Nothing is marked stale in eager mode, so everything must be up to date before leaving.
+    if (!lazy && parser->isLazy())
+    {
+        for (int i = 0; i < getRowCount(); ++i)
+            for (int j = 0; j < getColCount(); ++j)
+                parser->refresh({i, j});
+    }
+    parser->setLazy(lazy);
+}
+
+void Spreadsheet::refresh(int r, int c)
+{
+    if (parser->isLazy() && r < getRowCount() && c < getColCount())
+        parser->refresh({r, c});
+}
+
 spc::myvec<Cell *> Spreadsheet::getCellsInRange(std::pair<int, int> startPos, std::pair<int, int> endPos)
 {
     spc::myvec<Cell *> cellsInRange;
@@ -160,14 +271,7 @@ spc::myvec<Cell *> Spreadsheet::getCellsInRange(std::pair<int, int> startPos, st
 
 std::string Spreadsheet::getColumnLabel(int columnIndex) const
 {
-    std::string label;
-    while (columnIndex > 0)
-    {
-        columnIndex--;
-        label = static_cast<char>('A' + (columnIndex % 26)) + label;
-        columnIndex /= 26;
-    }
-    return label;
+    return columnIndex > 0 ? Cell::columnLetters(columnIndex - 1) : std::string();
 }
 
 std::string Spreadsheet::getCellLabel(int r, int c) const
@@ -224,7 +328,27 @@ void Spreadsheet::moveCell(int &currentRow, int &currentCol, const char dir)
 
 void Spreadsheet::displayScreen(int currentRow, int currentCol, AnsiTerminal& terminal, std::string inputLine)
 {
-    terminal.clearScreen();
+    auto frameStart = std::chrono::steady_clock::now();
+
+    // The frame is composed in the screen model, which only sends what changed since the last one.
+    if (terminal.checkResize())
+        screen.invalidate();
+
+    // Only the rows and columns that fit in the window are drawn, scrolled to keep the cursor visible.
+    int visibleRows = std::max(1, terminal.getRows() - 3 - (hudVisible ? 1 : 0));
+    int visibleCols = std::max(1, (terminal.getCols() - ROW_HEADER_WIDTH - 1) / COLUMN_WIDTH);
+    topRow = std::clamp(topRow, currentRow - visibleRows + 1, currentRow);
+    leftCol = std::clamp(leftCol, currentCol - visibleCols + 1, currentCol);
+    int endRow = std::min(getRowCount(), topRow + visibleRows);
+    int endCol = std::min(getColCount(), leftCol + visibleCols);
+
+    // In lazy mode only what is shown is brought up to date.
+    if (parser->isLazy())
+    {
+        for (int i = topRow; i < endRow; ++i)
+            for (int j = leftCol; j < endCol; ++j)
+                parser->refresh({i, j});
+    }
 
     // Get the formula from the current cell if it is a FormulaCell
     std::string cellFormula = "";
@@ -234,65 +358,153 @@ void Spreadsheet::displayScreen(int currentRow, int currentCol, AnsiTerminal& te
     }
 
     std::string letterRep = cells[currentRow][currentCol]->getLetterRepresentation();
-    terminal.printAt(1, 1, letterRep + " | Formula: " + cellFormula);
+    screen.put(1, 1, (letterRep + " | Formula: " + cellFormula).substr(0, terminal.getCols()));
 
     std::ostringstream headerLine;
     headerLine << std::setw(ROW_HEADER_WIDTH) << " ";
-    for (int j = 0; j < getColCount(); ++j)
+    for (int j = leftCol; j < endCol; ++j)
     {
         std::string colLabel = getColumnLabel(j + 1);
         headerLine << "|" << std::setw(COLUMN_WIDTH - 1) << colLabel;
     }
     headerLine << "|";
-    terminal.printAt(2, 1, inputLine);
-    terminal.printAt(3, 1, headerLine.str());
+    screen.put(2, 1, inputLine.substr(0, terminal.getCols()));
+    screen.put(3, 1, headerLine.str());
 
-    for (int i = 0; i < getRowCount(); ++i)
+    // Cells keep their formatted text cached, so a row is mostly copied together.
+    std::string rowText;
+    rowText.reserve(ROW_HEADER_WIDTH + (endCol - leftCol) * COLUMN_WIDTH + 1);
+    for (int i = topRow; i < endRow; ++i)
     {
-        std::ostringstream rowStream;
-        rowStream << std::setw(ROW_HEADER_WIDTH - 1) << (i + 1) << "|";
+        std::string rowLabel = std::to_string(i + 1);
+        rowText.assign(std::max(0, ROW_HEADER_WIDTH - 1 - static_cast<int>(rowLabel.size())), ' ');
+        rowText += rowLabel;
+        rowText += '|';
 
-        for (int j = 0; j < getColCount(); ++j)
+        for (int j = leftCol; j < endCol; ++j)
         {
-            std::string cellText = cells[i][j]->getValueAsString();
-            cellText = formatCellText(cellText, COLUMN_WIDTH);
-
-            if (i == currentRow && j == currentCol)
-                rowStream << "|" << "\033[7m" << cellText << "\033[0m";
-            else
-                rowStream << "|" << cellText;
+            rowText += '|';
+            rowText += cells[i][j]->getDisplayText(COLUMN_WIDTH);
+            if (recalc && recalc->isPending({i, j}))
+                rowText[rowText.size() - COLUMN_WIDTH + 1] = '~';  // Stale until recalculated
         }
-        rowStream << "|";
-        terminal.printAt(4 + i, 1, rowStream.str());
+        rowText += '|';
+        screen.put(4 + i - topRow, 1, rowText);
     }
+
+    // Highlight the current cell on top of its row.
+    std::string currentText = cells[currentRow][currentCol]->getDisplayText(COLUMN_WIDTH);
+    if (recalc && recalc->isPending({currentRow, currentCol}))
+        currentText[0] = '~';
+    screen.put(4 + currentRow - topRow, ROW_HEADER_WIDTH + (currentCol - leftCol) * COLUMN_WIDTH + 2, currentText, true);
+
+    if (hudVisible)
+        screen.put(terminal.getRows(), 1, hudLine().substr(0, terminal.getCols()), true);
+
+    screen.present(terminal);
+    lastFrameMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
 }
 
-std::string Spreadsheet::formatCellText(const std::string &cellText, int width)
+std::string Spreadsheet::hudLine()
 {
-    if (static_cast<int>(cellText.length()) >= width)
+    auto now = std::chrono::steady_clock::now();
+    if (now - hudMemoryAt >= std::chrono::milliseconds(HUD_MEMORY_MILLIS))
     {
-        return cellText.substr(0, width - 2) + ">";
+        hudMemory = estimateMemory();
+        hudMemoryAt = now;
     }
+
+    const ParserStats &stats = parser->getStats();
+    std::ostringstream hud;
+    hud << std::fixed << std::setprecision(2);
+    hud << " frame " << lastFrameMillis << "ms | recalc ";
+    if (parser->isLazy())
+        hud << "lazy";
+    else if (recalc)
+        hud << recalc->getLastPassMillis() << "ms/" << recalc->getLastPassCells() << " cells";
+    else
+        hud << "-";
+    hud << " | evals " << stats.evaluations << " | shared ";
+    if (stats.templateLookups > 0)
+        hud << std::setprecision(0) << 100.0 * stats.templateHits / stats.templateLookups << "%";
     else
+        hud << "-";
+    hud << std::setprecision(1) << " | mem " << hudMemory / 1024.0 << "KiB ";
+    return hud.str();
+}
+
+size_t Spreadsheet::estimateMemory() const
+{
+    size_t total = sizeof(*this) + cells.get_capacity() * sizeof(cells[0]);
+    for (int i = 0; i < getRowCount(); ++i)
     {
-        std::ostringstream oss;
-        oss << std::setw(width - 1) << std::right << cellText;
-        return oss.str();
+        total += cells[i].get_capacity() * sizeof(std::unique_ptr<Cell>);
+        for (int j = 0; j < getColCount(); ++j)
+            total += cells[i][j]->memoryUsage();
     }
+    return total;
 }
 
 void Spreadsheet::run()
 {
     AnsiTerminal terminal;
+    screen.invalidate();  // The terminal was used by the menu in between
+    topRow = leftCol = 0;
     int currentRow = 0, currentCol = 0;
     std::pair<int, int> oldLoc;
     std::string input;
+
+    // Dependents of edits are recalculated on the engine's thread while this loop keeps drawing.
+    RecalcEngine engine(*parser, cellsMutex);
+    struct Detach
+    {
+        Spreadsheet *sheet;
+        ~Detach() { sheet->recalc = nullptr; }  // Before the engine finishes and goes away
+    } detach{this};
+    recalc = &engine;
+
+    // Draws the screen and waits for a key, repainting while a recalculation makes progress.
+    auto nextKey = [&](const std::string &line) {
+        while (true)
+        {
+            bool idle = engine.isIdle();  // Checked before drawing, so an idle frame shows final values
+            {
+                std::lock_guard<std::mutex> lock(cellsMutex);
+                displayScreen(currentRow, currentCol, terminal, line);
+            }
+            if (terminal.waitForKey(idle ? -1 : REPAINT_MILLIS))
+                return terminal.getSpecialKey();
+        }
+    };
+
     while (true)
     {
-        input = cells[currentRow][currentCol]->getValueAsString();
-        displayScreen(currentRow, currentCol, terminal, input);
+        {
+            std::lock_guard<std::mutex> lock(cellsMutex);
+            refresh(currentRow, currentCol);
+            input = cells[currentRow][currentCol]->getValueAsString();
+        }
 
-        char command = terminal.getSpecialKey();
+        // Waiting for a key is idle time: make every edit so far durable first.
+        if (journal)
+            journal->commit();
+
+        char command = nextKey(input);
+
+        if (command == HUD_TOGGLE_KEY)
+        {
+            hudVisible = !hudVisible;
+            continue;
+        }
+
+        if (command == LAZY_TOGGLE_KEY)
+        {
+            // A background pass writes cells as eager mode does: let it finish before switching.
+            engine.waitIdle();
+            std::lock_guard<std::mutex> lock(cellsMutex);
+            setLazyEvaluation(!parser->isLazy());
+            continue;
+        }
 
         if (command == 'q')
         {
@@ -302,7 +514,12 @@ void Spreadsheet::run()
 
         if (terminal.isArrowKey(command))
         {
+            std::lock_guard<std::mutex> lock(cellsMutex);
             moveCell(currentRow, currentCol, command);
+
+            // A held arrow key repeats faster than frames are drawn: apply every queued move first.
+            while (terminal.isArrowKey(terminal.peekKey()))
+                moveCell(currentRow, currentCol, terminal.getSpecialKey());
             continue;
         }
 
@@ -321,9 +538,7 @@ void Spreadsheet::run()
 
             while (editing)
             {
-                displayScreen(currentRow, currentCol, terminal, input);
-
-                char editCommand = terminal.getSpecialKey();
+                char editCommand = nextKey(input);
 
                 if (editCommand == '\n')
                 {
@@ -336,6 +551,7 @@ void Spreadsheet::run()
                 else if (terminal.isArrowKey(editCommand))
                 {
                     editing = false;
+                    std::lock_guard<std::mutex> lock(cellsMutex);
                     moveCell(currentRow, currentCol, editCommand);
                 }
                 else if (isprint(editCommand))
@@ -344,9 +560,8 @@ void Spreadsheet::run()
                 }
             }
 
-            enterData(oldLoc.first, oldLoc.second, input);
-
-            parser.get()->autoCalculate(oldLoc);
+            std::lock_guard<std::mutex> lock(cellsMutex);
+            commitEdit(oldLoc.first, oldLoc.second, input);
 
             input.clear();
         }
@@ -1,15 +1,24 @@
 #ifndef SPREADSHEET_H
 #define SPREADSHEET_H
-
+    
 #include "Cell.h"
 #include "AnsiTerminal.h"
 #include "myvec.h"
 #include "FormulaParser.h"
+#include "EditJournal.h"
+#include "ScreenModel.h"
 #include <string>
 #include <stdexcept>
 #include <memory>
 #include <iostream>
-
+#include <atomic>
+#include <set>
+#include <vector>
+#include <mutex>
+#include <chrono>
+    
+class RecalcEngine;
+    
 /**
  * @class Spreadsheet
  * @brief A class representing a spreadsheet consisting of cells arranged 
@@ -25,10 +34,10 @@ class Spreadsheet
 {
 public:
     /** @brief Maximum number of rows in the spreadsheet. */
-    static const int MAX_ROWS = 100; 
+    static const int MAX_ROWS = 100000; 
     
-    /** @brief Maximum number of columns in the spreadsheet. */
-    static const int MAX_COLS = 50;
+    /** @brief Maximum number of columns in the spreadsheet: A to ZZ. */
+    static const int MAX_COLS = 702;
     
     /**
      * @brief Constructs a Spreadsheet object with a specified number of rows and columns.
@@ -42,7 +51,7 @@ public:
      * @brief Default constructor that creates a 3x3 spreadsheet.
      */
     Spreadsheet() : Spreadsheet(3, 3) {}
-
+    
     /**
      * @brief Retrieves a pointer to the cell at the specified row and column.
      * 
@@ -52,7 +61,7 @@ public:
      * @return A pointer to the Cell object at the specified position.
      */
     Cell *getCell(int r, int c) const;
-
+    
     /**
      * @brief Sets the cell at the specified row and column with a given cell object.
      * 
@@ -61,7 +70,7 @@ public:
      * @param cell A unique pointer to the Cell object to set at the specified position.
      */
     void setCell(int r, int c, std::unique_ptr<Cell> cell);
-
+    
     /**
      * @brief Enters data into a specified cell in the spreadsheet by taking a reference to the input string.
      * 
@@ -70,7 +79,7 @@ public:
      * @param input The input string containing the data to be entered into the cell.
      */
     void enterData(int r, int c, std::string& input);
-
+    
     /**
      * @brief Enters data into a specified cell in the spreadsheet by taking an r-value reference to the input string.
      * 
@@ -79,21 +88,111 @@ public:
      * @param input The input string containing the data to be entered into the cell.
      */
     void enterData(int r, int c, std::string&& input);
-
+    
+    /**
+     * @brief Commits a user edit: enters the data, recalculates the cells that depend on it
+     *        (or marks them stale, see setLazyEvaluation) and appends the edit to the attached journal, if any. While run() is active the
+     *        dependents are recalculated in the background and the caller must hold the cell mutex.
+     *        The grid is expanded when the target cell lies beyond its current size.
+     * 
+     * @param r The row index of the cell.
+     * @param c The column index of the cell.
+     * @param input The raw input entered into the cell.
+     */
+    void commitEdit(int r, int c, const std::string& input);
+    
+    /**
+     * @brief Commits many edits at once: enters all the data first, then recalculates the
+     *        dependents of every edited cell in a single pass, so a cell read by several of
+     *        the edited cells is evaluated once rather than once per edit. The edits are
+     *        journaled like commitEdit's. Must not be called while run() is active.
+     * 
+     * @param edits The (row, column) and raw input of every edit, applied in order.
+     */
+    void commitEdits(const std::vector<std::pair<std::pair<int, int>, std::string>>& edits);
+    
+    /**
+     * @brief Re-evaluates every formula in the spreadsheet in dependency order; in lazy mode
+     *        they are only marked stale. Must not be called while run() is active.
+     * 
+     * @return The number of formula cells evaluated, 0 in lazy mode.
+     */
+    size_t recalculateAll();
+    
+    /**
+     * @brief Switches between eager and lazy evaluation. Eagerly, an edit recalculates every
+     *        formula depending on it; lazily, it only marks them stale, and a formula is computed
+     *        when it is displayed, read by another formula or asked for through refresh.
+     *        Edits then cost the same however many formulas depend on them. Switching back to
+     *        eager brings every stale formula up to date.
+     * 
+     * @param lazy True for lazy evaluation.
+     */
+    void setLazyEvaluation(bool lazy);
+    
+    /**
+     * @brief Brings a cell's value up to date before it is read; a no-op in eager mode, where
+     *        values always are. Cells beyond the grid are ignored.
+     * 
+     * @param r The row index of the cell.
+     * @param c The column index of the cell.
+     */
+    void refresh(int r, int c);
+    
+    /**
+     * @brief Attaches an edit journal that records every committed edit.
+     * 
+     * @param j A pointer to the journal, or nullptr to detach. The spreadsheet does not own it.
+     */
+    void attachJournal(EditJournal* j) { journal = j; }
+    
+    /**
+     * @brief Tells whether the spreadsheet has edits that were not saved to its file yet.
+     * 
+     * @return True if an edit was committed since the last save.
+     */
+    bool isModified() const { return modified; }
+    
+    /**
+     * @brief Sets or clears the unsaved-edits flag.
+     * 
+     * @param m False right after the spreadsheet was saved.
+     */
+    void setModified(bool m) { modified = m; }
+    
+    /**
+     * @brief Returns the tiles whose cells changed since the spreadsheet was last loaded or saved.
+     * 
+     * @return The set of (row block, column) pairs; a row block spans ColumnarFile::TILE_ROWS rows.
+     */
+    const std::set<std::pair<int, int>> &getDirtyTiles() const { return dirtyTiles; }
+    
+    /**
+     * @brief Tells whether the changed tiles are unknown, e.g. for a sheet never loaded or saved.
+     * 
+     * @return True if every tile has to be treated as changed.
+     */
+    bool isFullyDirty() const { return fullyDirty; }
+    
+    /**
+     * @brief Forgets the changed tiles; called once the spreadsheet matches its file.
+     */
+    void markClean();
+    
     /**
      * @brief Returns the total number of rows in the spreadsheet.
      * 
      * @return The number of rows in the spreadsheet.
      */
     int getRowCount() const { return cells.get_size(); }
-
+    
     /**
      * @brief Returns the total number of columns in the spreadsheet.
      * 
      * @return The number of columns in the spreadsheet.
      */
     int getColCount() const { return cells[0].get_size(); }
-
+    
     /**
      * @brief Retrieves a list of cells within a specified range.
      * 
@@ -103,9 +202,17 @@ public:
      * @return A vector of pointers to the cells within the specified range.
      */
     spc::myvec<Cell *> getCellsInRange(std::pair<int, int> startPos, std::pair<int, int> endPos);
-
+    
+    /**
+     * @brief Estimates the memory used by the cells of the spreadsheet.
+     * 
+     * @return Size in bytes.
+     */
+    size_t estimateMemory() const;
+    
     /**
-     * @brief Displays the contents of the spreadsheet on the terminal.
+     * @brief Displays the part of the spreadsheet that fits in the terminal window,
+     *        scrolling as needed to keep the current cell visible.
      * 
      * @param currentRow The current row index to highlight.
      * @param currentCol The current column index to highlight.
@@ -113,9 +220,11 @@ public:
      * @param inputLine The input line to be displayed, if any.
      */
     void displayScreen(int currentRow, int currentCol, AnsiTerminal& terminal, std::string inputLine = "");
-
+    
     /**
      * @brief Runs the spreadsheet, initiating the user interface and interactive features.
+     *        Ctrl+T toggles the performance HUD and Ctrl+E switches between eager and lazy
+     *        evaluation (see setLazyEvaluation).
      */
     void run();
     
@@ -123,14 +232,58 @@ public:
      * @brief Friend class FileHandler, allowing it to access private members of Spreadsheet.
      */
     friend class FileHandler;
-
+    
+    /**
+     * @brief Friend class ColumnarFile, allowing it to size the grid while loading.
+     */
+    friend class ColumnarFile;
+    
 private:
     /** @brief A dynamic 2D array (vector of vectors) holding the cells in the spreadsheet. */
     spc::myvec<spc::myvec<std::unique_ptr<Cell>>> cells;
-
+    
     /** @brief A shared pointer to the FormulaParser object used for parsing formulas. */
     std::shared_ptr<FormulaParser> parser;
-
+    
+    /** @brief The journal receiving committed edits, or nullptr when edits are not journaled. */
+    EditJournal* journal = nullptr;
+    
+    /** @brief Whether edits were committed since the spreadsheet was last saved. */
+    std::atomic<bool> modified{false};
+    
+    /** @brief Tiles changed since the last load or save, as (row block, column) pairs. */
+    std::set<std::pair<int, int>> dirtyTiles;
+    
+    /** @brief Whether dirtyTiles is meaningless and every tile counts as changed. */
+    bool fullyDirty = true;
+    
+    /** @brief The last frame drawn by displayScreen, used to redraw only what changed. */
+    ScreenModel screen;
+    
+    /** @brief Guards the cells while run() recalculates in the background. */
+    std::mutex cellsMutex;
+    
+    /** @brief The background recalculation engine while run() is active, or nullptr. */
+    RecalcEngine* recalc = nullptr;
+    
+    /** @brief Whether the performance HUD is shown on the bottom line (toggled with Ctrl+T). */
+    bool hudVisible = false;
+    
+    /** @brief How long the previous frame took to compose and draw, in milliseconds. */
+    double lastFrameMillis = 0;
+    
+    /** @brief The last result of estimateMemory, refreshed at most every HUD_MEMORY_MILLIS. */
+    size_t hudMemory = 0;
+    
+    /** @brief When hudMemory was computed. */
+    std::chrono::steady_clock::time_point hudMemoryAt;
+    
+    /** @brief The first row shown in the window. */
+    int topRow = 0;
+    
+    /** @brief The first column shown in the window. */
+    int leftCol = 0;
+    
     /**
      * @brief Expands the spreadsheet to accommodate more rows and columns.
      * 
@@ -138,7 +291,7 @@ private:
      * @param newColCount The new number of columns.
      */
     void expand(int newRowCount, int newColCount);
-
+    
     /**
      * @brief Returns the column label for a given column index (e.g., "A", "B", "C").
      * 
@@ -147,7 +300,7 @@ private:
      * @return The label corresponding to the given column index.
      */
     std::string getColumnLabel(int columnIndex) const;
-
+    
     /**
      * @brief Returns the label for a specific cell, formatted as "A1", "B2", etc.
      * 
@@ -157,17 +310,7 @@ private:
      * @return The label for the cell at the specified position.
      */
     std::string getCellLabel(int r, int c) const;
-
-    /**
-     * @brief Formats the text of a cell to fit within a specified width.
-     * 
-     * @param cellText The text to format.
-     * @param width The width to which the text should be formatted.
-     * 
-     * @return The formatted cell text.
-     */
-    std::string formatCellText(const std::string &cellText, int width);
-
+    
     /**
      * @brief Moves the current cell cursor based on the direction input.
      * 
@@ -176,6 +319,15 @@ private:
      * @param dir A character representing the direction (e.g., 'U', 'D', 'L', 'R').
      */
     void moveCell(int &currentRow, int &currentCol, const char dir);
+    
+    /**
+     * @brief Builds the performance HUD line: frame and recalculation times,
+     *        formulas evaluated, share of formulas that reused a compiled template and memory use.
+     * 
+     * @return The text of the HUD line.
+     */
+    std::string hudLine();
 };
-
+    
 #endif
+    
\ No newline at end of file
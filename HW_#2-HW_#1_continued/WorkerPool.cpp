@@ -0,0 +1,72 @@
+#include "WorkerPool.h"
+#include <algorithm>
+
+WorkerPool::WorkerPool(unsigned threads)
+{
+    if (threads == 0)
+        threads = std::min(8u, std::max(2u, std::thread::hardware_concurrency()));
+
+    for (unsigned i = 0; i < threads; ++i)
+        workers.emplace_back(&WorkerPool::workerLoop, this);
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskReady.notify_all();
+
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+void WorkerPool::submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(task));
+    }
+    taskReady.notify_one();
+}
+
+void WorkerPool::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return tasks.empty() && running == 0; });
+}
+
+void WorkerPool::workerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskReady.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty())
+                return; // stopping, and the queue has been drained
+
+            task = std::move(tasks.front());
+            tasks.pop();
+            ++running;
+        }
+
+        try
+        {
+            task();
+        }
+        catch (...)
+        {
+            // Tasks record their own failures.
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --running;
+            if (tasks.empty() && running == 0)
+                idle.notify_all();
+        }
+    }
+}
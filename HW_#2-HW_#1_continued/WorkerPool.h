@@ -0,0 +1,68 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <functional>
+#include <queue>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * @class WorkerPool
+ * @brief A fixed number of worker threads executing submitted tasks in FIFO order.
+ *
+ * The pool is bounded: no matter how many tasks are queued, at most
+ * getThreadCount() of them run at the same time.
+ */
+class WorkerPool
+{
+public:
+    /**
+     * @brief Starts the worker threads.
+     * @param threads The number of workers; 0 picks one per hardware thread, capped at 8.
+     */
+    explicit WorkerPool(unsigned threads = 0);
+
+    /**
+     * @brief Destructor: runs the tasks still queued, then joins the workers.
+     */
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    /**
+     * @brief Queues a task for execution on one of the workers.
+     *        Exceptions escaping the task are swallowed; tasks report their own errors.
+     * @param task The task to run.
+     */
+    void submit(std::function<void()> task);
+
+    /**
+     * @brief Blocks until the queue is empty and no task is running.
+     */
+    void waitIdle();
+
+    /**
+     * @brief Returns the number of worker threads.
+     * @return The thread count.
+     */
+    unsigned getThreadCount() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+    std::vector<std::thread> workers;              ///< The worker threads.
+    std::queue<std::function<void()>> tasks;       ///< Tasks waiting for a worker.
+    std::mutex mutex;                              ///< Guards tasks, running and stopping.
+    std::condition_variable taskReady;             ///< Signalled when a task is queued or on shutdown.
+    std::condition_variable idle;                  ///< Signalled when the pool runs out of work.
+    unsigned running = 0;                          ///< Number of tasks currently executing.
+    bool stopping = false;                         ///< Set by the destructor.
+
+    /**
+     * @brief The loop executed by every worker thread.
+     */
+    void workerLoop();
+};
+
+#endif
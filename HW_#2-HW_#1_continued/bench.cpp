@@ -0,0 +1,432 @@
+// Benchmarks for the spreadsheet engine; built with "make bench".
+//
+// Usage: ./bench.out [--filter <substring>] [--min-time <milliseconds>]
+//
+// Prints one JSON document with ns/op, heap allocations/op and throughput for
+// every benchmark, so that results can be compared across commits.
+
+#include "Spreadsheet.h"
+#include "FormulaParser.h"
+#include "FileHandler.h"
+#include "AnsiTerminal.h"
+#include "myvec.h"
+#include "myset.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fcntl.h>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    std::atomic<uint64_t> allocations{0};
+}
+
+// Every heap allocation of the process goes through these.
+void *operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    const int ROWS = 100; // Size of the sheets the benchmarks run on
+    const int COLS = 50;
+
+    struct Result
+    {
+        std::string name;
+        uint64_t iterations;
+        double nsPerOp;
+        double allocsPerOp;
+        double itemsPerOp;   // Work done by one operation, in units of unit
+        std::string unit;
+    };
+
+    /**
+     * @brief Runs op until at least minMillis have passed, doubling the batch size each round.
+     *        A setup, if given, runs before every op with its time and allocations left out.
+     */
+    Result measure(const std::string &name, double minMillis, double itemsPerOp, const std::string &unit,
+                   const std::function<void()> &op, const std::function<void()> &setup = {})
+    {
+        if (setup) // Warm-up: fills caches and lets containers reach their steady size
+            setup();
+        op();
+
+        uint64_t iterations = 0;
+        uint64_t batch = 1;
+        uint64_t allocsBefore = allocations.load(std::memory_order_relaxed);
+        uint64_t setupAllocs = 0;
+        double setupNanos = 0;
+        auto start = Clock::now();
+        double elapsed = 0;
+        while (elapsed < minMillis * 1e6)
+        {
+            for (uint64_t i = 0; i < batch; ++i)
+            {
+                if (setup)
+                {
+                    auto setupStart = Clock::now();
+                    uint64_t allocsAtSetup = allocations.load(std::memory_order_relaxed);
+                    setup();
+                    setupAllocs += allocations.load(std::memory_order_relaxed) - allocsAtSetup;
+                    setupNanos += std::chrono::duration<double, std::nano>(Clock::now() - setupStart).count();
+                }
+                op();
+            }
+            iterations += batch;
+            batch *= 2;
+            elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count() - setupNanos;
+        }
+        uint64_t allocs = allocations.load(std::memory_order_relaxed) - allocsBefore - setupAllocs;
+
+        return {name, iterations, elapsed / iterations, static_cast<double>(allocs) / iterations, itemsPerOp, unit};
+    }
+
+    /** @brief A1 = 1 and every cell below reads the one above: an edit of A1 recalculates the whole column. */
+    void buildChain(Spreadsheet &sheet, int length)
+    {
+        sheet.commitEdit(0, 0, "1");
+        for (int r = 1; r < length; ++r)
+            sheet.commitEdit(r, 0, "=" + Cell::referenceName(r - 1, 0) + "+1");
+    }
+
+    /** @brief Every cell of columns B onwards reads A1 directly. */
+    void buildFanout(Spreadsheet &sheet, int rows, int cols)
+    {
+        sheet.commitEdit(0, 0, "1");
+        std::vector<std::pair<std::pair<int, int>, std::string>> edits;
+        for (int r = 0; r < rows; ++r)
+            for (int c = 1; c < cols; ++c)
+                edits.push_back({{r, c}, "=A1*" + std::to_string(c)});
+        sheet.commitEdits(edits);
+    }
+
+    /** @brief A lattice where every cell adds its upper and left neighbours: many paths lead from A1 to each cell. */
+    void buildDiamond(Spreadsheet &sheet, int size)
+    {
+        std::vector<std::pair<std::pair<int, int>, std::string>> edits;
+        for (int r = 0; r < size; ++r)
+        {
+            for (int c = 0; c < size; ++c)
+            {
+                if (r == 0 && c == 0)
+                    edits.push_back({{r, c}, "1"});
+                else if (r == 0)
+                    edits.push_back({{r, c}, "=" + Cell::referenceName(r, c - 1)});
+                else if (c == 0)
+                    edits.push_back({{r, c}, "=" + Cell::referenceName(r - 1, c)});
+                else
+                    edits.push_back({{r, c}, "=" + Cell::referenceName(r - 1, c) + "+" + Cell::referenceName(r, c - 1)});
+            }
+        }
+        sheet.commitEdits(edits);
+    }
+
+    /** @brief Fills the grid with a mix of integers, doubles and text. */
+    void fillValues(Spreadsheet &sheet, int rows, int cols)
+    {
+        std::vector<std::pair<std::pair<int, int>, std::string>> edits;
+        for (int r = 0; r < rows; ++r)
+        {
+            for (int c = 0; c < cols; ++c)
+            {
+                int kind = (r * cols + c) % 10;
+                if (kind < 6)
+                    edits.push_back({{r, c}, std::to_string(r * c % 997)});
+                else if (kind < 9)
+                    edits.push_back({{r, c}, std::to_string(r + c) + ".25"});
+                else
+                    edits.push_back({{r, c}, "item" + std::to_string(r)});
+            }
+        }
+        sheet.commitEdits(edits);
+    }
+
+    /** @brief Appends n elements made by make to an empty Vector; used to compare spc::myvec with std::vector. */
+    template <typename Vector, typename Make>
+    void fillVector(int n, Make make)
+    {
+        Vector v;
+        for (int i = 0; i < n; ++i)
+            v.push_back(make(i));
+    }
+
+    void printJson(const std::vector<Result> &results)
+    {
+        std::cout << "{\"benchmarks\":[";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result &r = results[i];
+            double opsPerSec = 1e9 / r.nsPerOp;
+            char line[512];
+            std::snprintf(line, sizeof(line),
+                          "%s\n  {\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,"
+                          "\"ops_per_sec\":%.1f,\"items_per_op\":%.0f,\"items_per_sec\":%.1f,\"unit\":\"%s\"}",
+                          i ? "," : "", r.name.c_str(), static_cast<unsigned long long>(r.iterations), r.nsPerOp,
+                          r.allocsPerOp, opsPerSec, r.itemsPerOp, r.itemsPerOp * opsPerSec, r.unit.c_str());
+            std::cout << line;
+        }
+        std::cout << "\n]}" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::string filter;
+    double minMillis = 200;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string option = argv[i];
+        if (option == "--filter")
+            filter = argv[i + 1];
+        else if (option == "--min-time")
+            minMillis = std::atof(argv[i + 1]);
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [--filter <substring>] [--min-time <milliseconds>]" << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<Result> results;
+    auto runAfter = [&](const std::string &name, double itemsPerOp, const std::string &unit,
+                        const std::function<void()> &setup, const std::function<void()> &op) {
+        if (name.find(filter) == std::string::npos)
+            return;
+        results.push_back(measure(name, minMillis, itemsPerOp, unit, op, setup));
+        std::cerr << name << ": " << results.back().nsPerOp << " ns/op" << std::endl;
+    };
+    auto run = [&](const std::string &name, double itemsPerOp, const std::string &unit, const std::function<void()> &op) {
+        runAfter(name, itemsPerOp, unit, {}, op);
+    };
+
+    // The engine's containers against the standard library's.
+    {
+        const int n = 1000;
+        auto makeInt = [](int i) { return i; };
+        auto makeString = [](int i) { return std::string("token") + static_cast<char>('a' + i % 26); };
+        auto makeCell = [](int i) { return std::unique_ptr<Cell>(new IntValueCell(0, i, i)); };
+        run("myvec_push_int", n, "elements", [&] { fillVector<spc::myvec<int>>(n, makeInt); });
+        run("vector_push_int", n, "elements", [&] { fillVector<std::vector<int>>(n, makeInt); });
+        run("myvec_push_string", n, "elements", [&] { fillVector<spc::myvec<std::string>>(n, makeString); });
+        run("vector_push_string", n, "elements", [&] { fillVector<std::vector<std::string>>(n, makeString); });
+        run("myvec_push_cell", n, "elements", [&] { fillVector<spc::myvec<std::unique_ptr<Cell>>>(n, makeCell); });
+        run("vector_push_cell", n, "elements", [&] { fillVector<std::vector<std::unique_ptr<Cell>>>(n, makeCell); });
+        run("myset_insert_cells", n, "elements", [&] {
+            spc::myset<std::pair<int, int>> cells;
+            for (int i = 0; i < n; ++i)
+                cells.insert({i / 10, i % 10});
+            for (int i = 0; i < n; ++i)
+                cells.insert({i / 10, i % 10}); // Duplicates, as a range overlapping a reference gives
+        });
+    }
+
+    // Formula parsing: a cold parse compiles a new formula, a shared one finds the template
+    // a cell holding the same formula keeps alive and skips compiling.
+    {
+        Spreadsheet sheet(ROWS, COLS);
+        fillValues(sheet, 10, 10);
+        FormulaParser parser(&sheet);
+        std::vector<std::string> formulas;
+        for (int i = 0; i < 8192; ++i)
+            formulas.push_back("=A1+B2*3-C3/2+D4*" + std::to_string(i));
+        size_t next = 0;
+        run("parse_cold", 1, "formulas", [&] {
+            spc::myvec<std::pair<int, int>> dependents;
+            parser.parseAndEvaluate(formulas[next++ % formulas.size()], {20, 20}, dependents);
+        });
+        std::shared_ptr<const FormulaTemplate> held = parser.compile(formulas[0], {20, 20});
+        run("parse_shared", 1, "formulas", [&] {
+            spc::myvec<std::pair<int, int>> dependents;
+            parser.parseAndEvaluate(formulas[0], {20, 20}, dependents);
+        });
+    }
+
+    // Single-edit recalculation over the three dependency shapes.
+    {
+        Spreadsheet sheet(ROWS, 1);
+        buildChain(sheet, ROWS);
+        int value = 0;
+        run("recalc_chain_" + std::to_string(ROWS), ROWS - 1, "cells", [&] {
+            sheet.commitEdit(0, 0, std::to_string(++value % 100));
+        });
+    }
+    {
+        const int rows = ROWS;
+        const int cols = 11;
+        Spreadsheet sheet(rows, cols);
+        buildFanout(sheet, rows, cols);
+        int value = 0;
+        run("recalc_fanout_" + std::to_string(rows * (cols - 1)), rows * (cols - 1), "cells", [&] {
+            sheet.commitEdit(0, 0, std::to_string(++value % 100));
+        });
+    }
+    {
+        const int size = 20;
+        Spreadsheet sheet(size, size);
+        buildDiamond(sheet, size);
+        int value = 0;
+        run("recalc_diamond_" + std::to_string(size) + "x" + std::to_string(size), size * size - 1, "cells", [&] {
+            sheet.commitEdit(0, 0, std::to_string(++value % 2));
+        });
+    }
+
+    // The chain again, evaluated lazily: an edit only brings the rows on screen up to date.
+    {
+        const int visible = 40;
+        Spreadsheet sheet(ROWS, 1);
+        buildChain(sheet, ROWS);
+        sheet.setLazyEvaluation(true);
+        int value = 0;
+        run("lazy_chain_" + std::to_string(ROWS), visible, "cells", [&] {
+            sheet.commitEdit(0, 0, std::to_string(++value % 100));
+            for (int r = 0; r < visible; ++r)
+                sheet.refresh(r, 0);
+        });
+    }
+
+    // Whole-sheet recalculation of a derived column filled down from one formula.
+    {
+        Spreadsheet sheet(ROWS, 3);
+        std::vector<std::pair<std::pair<int, int>, std::string>> edits;
+        for (int r = 0; r < ROWS; ++r)
+        {
+            edits.push_back({{r, 0}, std::to_string(r)});
+            edits.push_back({{r, 1}, std::to_string(r % 7 + 1)});
+            edits.push_back({{r, 2}, "=" + Cell::referenceName(r, 0) + "*" + Cell::referenceName(r, 1) + "+" + Cell::referenceName(r, 0) + "/" + Cell::referenceName(r, 1)});
+        }
+        sheet.commitEdits(edits);
+        run("recalc_all_derived_" + std::to_string(ROWS), ROWS, "cells", [&] { sheet.recalculateAll(); });
+    }
+
+    // A dashboard: fifty formulas over the same two aggregates of A1..B100, recalculated by an edit of A1.
+    {
+        Spreadsheet sheet(ROWS, 4);
+        fillValues(sheet, ROWS, 2);
+        std::vector<std::pair<std::pair<int, int>, std::string>> edits;
+        std::string range = "($A$1..$B$" + std::to_string(ROWS) + ")";
+        for (int r = 0; r < 50; ++r)
+            edits.push_back({{r, 3}, "=SUM" + range + "/AVER" + range + "+" + std::to_string(r)});
+        sheet.commitEdits(edits);
+        int value = 0;
+        run("recalc_dashboard_50", 50, "cells", [&] {
+            sheet.commitEdit(0, 0, std::to_string(++value % 100));
+        });
+    }
+
+    // Range aggregates over A1..J100, evaluated from a cell outside the range.
+    {
+        Spreadsheet sheet(ROWS, 12);
+        fillValues(sheet, ROWS, 10);
+        FormulaParser parser(&sheet);
+        int covered = ROWS * 12 - 2;
+        for (const char *function : {"SUM", "AVER", "STDDEV", "MAX"})
+        {
+            std::string formula = std::string("=") + function + "(A1..J" + std::to_string(ROWS) + ")";
+            run(std::string("range_") + function, covered, "cells", [&] {
+                spc::myvec<std::pair<int, int>> dependents;
+                parser.parseAndEvaluate(formula, {ROWS - 1, 11}, dependents);
+            });
+        }
+    }
+
+    // CSV save and load of a full-size sheet with a tenth of the cells holding formulas.
+    {
+        const int rows = ROWS;
+        const int cols = COLS;
+        Spreadsheet sheet(rows, cols);
+        fillValues(sheet, rows, cols);
+        std::vector<std::pair<std::pair<int, int>, std::string>> formulas;
+        for (int r = 1; r < rows; r += 2)
+            for (int c = 0; c < cols; c += 5)
+                formulas.push_back({{r, c}, "=" + Cell::referenceName(r - 1, c) + "+" + Cell::referenceName(r - 1, c + 1)});
+        sheet.commitEdits(formulas);
+
+        // Serialized into memory: saveToFile adds an fsync and a rename, which time the disk.
+        FileHandler files;
+        std::ostringstream csv;
+        files.writeCsv(csv, sheet);
+        double bytes = static_cast<double>(csv.str().size());
+        run("csv_write", bytes, "bytes", [&] {
+            csv.str(std::string());
+            files.writeCsv(csv, sheet);
+        });
+
+        std::string path = (std::filesystem::temp_directory_path() / ("bench-" + std::to_string(getpid()) + ".csv")).string();
+        files.saveToFile(path, sheet);
+        run("csv_load", bytes, "bytes", [&] {
+            Spreadsheet loaded;
+            files.loadFromFile(path, loaded);
+        });
+        std::filesystem::remove(path);
+    }
+
+    // Rendering into a terminal whose output goes to /dev/null; standard input is left alone.
+    {
+        int nullFd = open("/dev/null", O_WRONLY);
+        if (nullFd < 0)
+        {
+            std::perror("/dev/null");
+            return 1;
+        }
+        {
+            AnsiTerminal terminal(nullFd, false);
+            Spreadsheet sheet(ROWS, COLS);
+            fillValues(sheet, ROWS, COLS);
+            int row = 0;
+            run("render_cursor_move", 1, "frames", [&] {
+                row = (row + 1) % 10;
+                sheet.displayScreen(row, 0, terminal);
+            });
+            int value = 0;
+            runAfter("render_after_edit", 1, "frames",
+                     [&] { sheet.commitEdit(0, 0, std::to_string(++value % 1000)); },
+                     [&] { sheet.displayScreen(0, 0, terminal); });
+        }
+        close(nullFd);
+    }
+
+    printJson(results);
+    return 0;
+}
@@ -0,0 +1,284 @@
+// Synthetic workload generator for large, formula-heavy sheets; built with "make gen".
+//
+// Usage: ./gen.out [options] <output.csv | output.scol>
+//
+//   --rows N        Number of rows (default 1000).
+//   --cols N        Number of columns (default 26).
+//   --formulas F    Fraction of cells holding a formula (default 0.2); diamond ignores it.
+//   --text F        Fraction of the value cells holding text (default 0.1).
+//   --doubles F     Fraction of the numeric cells holding a double (default 0.3).
+//   --topology T    How formulas depend on each other (default mixed):
+//                     chain    every formula reads the formula before it, forming one long chain
+//                     fanout   every formula reads one of a few hub cells in the first row
+//                     diamond  every cell but A1 reads its upper and left neighbours
+//                     ranges   every formula aggregates the --span rows above it, so ranges overlap
+//                     xref     every formula reads two to four random cells before it
+//                     mixed    each formula picks one of chain, fanout, ranges and xref
+//   --span N        Rows aggregated by a range formula (default 10).
+//   --seed N        Seed of the random generator (default 1); equal seeds give equal sheets.
+//
+// Formulas only read cells that come before them in reading order, so every
+// formula can be evaluated when the sheet is loaded. CSV output is streamed row
+// by row; columnar output is built in memory and saved with FileHandler.
+
+#include "Spreadsheet.h"
+#include "FileHandler.h"
+#include "ColumnarFile.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const char *FUNCTIONS[] = {"SUM", "AVER", "MAX", "MIN", "STDDEV"};
+
+    struct Options
+    {
+        int rows = 1000;
+        int cols = 26;
+        double formulas = 0.2;
+        double text = 0.1;
+        double doubles = 0.3;
+        std::string topology = "mixed";
+        int span = 10;
+        uint64_t seed = 1;
+        std::string output;
+    };
+
+    /** @brief splitmix64: small, fast and identical on every platform. */
+    class Random
+    {
+    public:
+        explicit Random(uint64_t seed) : state(seed) {}
+
+        uint64_t next()
+        {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+
+        /** @brief A number in [0, bound). */
+        uint64_t below(uint64_t bound) { return next() % bound; }
+
+        /** @brief True with the given probability. */
+        bool chance(double probability) { return (next() >> 11) * (1.0 / 9007199254740992.0) < probability; }
+
+    private:
+        uint64_t state;
+    };
+
+    /**
+     * @brief Produces the cells of the sheet row by row.
+     */
+    class Generator
+    {
+    public:
+        explicit Generator(const Options &options) : options(options), random(options.seed) {}
+
+        /** @brief Returns the raw input of every cell of the next row. */
+        std::vector<std::string> nextRow()
+        {
+            std::vector<std::string> row(options.cols);
+            for (int c = 0; c < options.cols; ++c)
+                row[c] = cell(c);
+            ++r;
+            return row;
+        }
+
+    private:
+        const Options &options;
+        Random random;
+        int r = 0;                     // The row being generated
+        int lastFormula = -1;          // Reading-order index of the previous formula, for chains
+
+        std::string cell(int c)
+        {
+            const std::string &topology = options.topology;
+            int index = r * options.cols + c;
+
+            if (topology == "diamond")
+            {
+                if (r == 0 && c == 0)
+                    return "1";
+                if (r == 0)
+                    return "=" + Cell::referenceName(r, c - 1);
+                if (c == 0)
+                    return "=" + Cell::referenceName(r - 1, c);
+                // Halving keeps the values finite however large the lattice is.
+                return "=" + Cell::referenceName(r - 1, c) + "/2+" + Cell::referenceName(r, c - 1) + "/2";
+            }
+
+            if (index == 0 || !random.chance(options.formulas))
+                return value();
+
+            std::string kind = topology;
+            if (kind == "mixed")
+            {
+                static const char *KINDS[] = {"chain", "fanout", "ranges", "xref"};
+                kind = KINDS[random.below(4)];
+            }
+
+            std::string formula;
+            if (kind == "chain")
+                formula = chain(index);
+            else if (kind == "fanout")
+                formula = fanout(c);
+            else if (kind == "ranges")
+                formula = range(c);
+            else
+                formula = xref(index);
+            lastFormula = index;
+            return formula;
+        }
+
+        std::string value()
+        {
+            if (random.chance(options.text))
+                return "item" + std::to_string(random.below(10000));
+            if (random.chance(options.doubles))
+                return std::to_string(random.below(100000)) + "." + std::to_string(10 + random.below(90));
+            return std::to_string(random.below(1000));
+        }
+
+        std::string chain(int index)
+        {
+            int previous = lastFormula >= 0 ? lastFormula : index - 1;
+            return "=" + Cell::referenceName(previous / options.cols, previous % options.cols) + "+1";
+        }
+
+        std::string fanout(int c)
+        {
+            // The hubs are the first few cells of the first row, all before any formula outside it.
+            int hubs = std::min(4, options.cols);
+            int hub = static_cast<int>(random.below(hubs));
+            if (r == 0 && hub >= c)
+                hub = 0;
+            return "=" + Cell::referenceName(0, hub) + "*" + std::to_string(1 + random.below(9));
+        }
+
+        std::string range(int c)
+        {
+            // A range in reading order from span rows above to the row above covers only earlier cells.
+            if (r == 0)
+                return "=" + Cell::referenceName(0, c - 1) + "+1";
+            int from = std::max(0, r - options.span);
+            const char *function = FUNCTIONS[random.below(5)];
+            return std::string("=") + function + "(" + Cell::referenceName(from, c) + ".." + Cell::referenceName(r - 1, c) + ")";
+        }
+
+        std::string xref(int index)
+        {
+            int count = 2 + static_cast<int>(random.below(3));
+            std::string formula = "=";
+            for (int i = 0; i < count; ++i)
+            {
+                int target = static_cast<int>(random.below(index));
+                if (i)
+                    formula += random.chance(0.5) ? "+" : "-";
+                formula += Cell::referenceName(target / options.cols, target % options.cols);
+            }
+            return formula;
+        }
+    };
+
+    bool parseOptions(int argc, char *argv[], Options &options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg.rfind("--", 0) != 0)
+            {
+                options.output = arg;
+                continue;
+            }
+            if (i + 1 >= argc)
+                return false;
+            std::string value = argv[++i];
+            if (arg == "--rows")
+                options.rows = std::atoi(value.c_str());
+            else if (arg == "--cols")
+                options.cols = std::atoi(value.c_str());
+            else if (arg == "--formulas")
+                options.formulas = std::atof(value.c_str());
+            else if (arg == "--text")
+                options.text = std::atof(value.c_str());
+            else if (arg == "--doubles")
+                options.doubles = std::atof(value.c_str());
+            else if (arg == "--topology")
+                options.topology = value;
+            else if (arg == "--span")
+                options.span = std::atoi(value.c_str());
+            else if (arg == "--seed")
+                options.seed = std::strtoull(value.c_str(), nullptr, 10);
+            else
+                return false;
+        }
+
+        static const char *TOPOLOGIES[] = {"chain", "fanout", "diamond", "ranges", "xref", "mixed"};
+        bool knownTopology = false;
+        for (const char *topology : TOPOLOGIES)
+            knownTopology = knownTopology || options.topology == topology;
+
+        return !options.output.empty() && knownTopology && options.span > 0 &&
+               options.rows > 0 && options.rows <= Spreadsheet::MAX_ROWS &&
+               options.cols > 0 && options.cols <= Spreadsheet::MAX_COLS;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        std::cerr << "Usage: " << argv[0] << " [--rows N] [--cols N] [--formulas F] [--text F] [--doubles F]\n"
+                  << "       [--topology chain|fanout|diamond|ranges|xref|mixed] [--span N] [--seed N]\n"
+                  << "       <output.csv | output.scol>\n"
+                  << "Rows and columns are limited to " << Spreadsheet::MAX_ROWS << " and " << Spreadsheet::MAX_COLS << "."
+                  << std::endl;
+        return 2;
+    }
+
+    Generator generator(options);
+    try
+    {
+        if (ColumnarFile::isColumnarPath(options.output))
+        {
+            Spreadsheet sheet(options.rows, options.cols);
+            for (int r = 0; r < options.rows; ++r)
+            {
+                std::vector<std::string> row = generator.nextRow();
+                for (int c = 0; c < options.cols; ++c)
+                    sheet.enterData(r, c, row[c]);
+            }
+            FileHandler().saveToFile(options.output, sheet);
+        }
+        else
+        {
+            std::ofstream out(options.output);
+            if (!out)
+                throw std::runtime_error("Cannot write " + options.output);
+            for (int r = 0; r < options.rows; ++r)
+            {
+                std::vector<std::string> row = generator.nextRow();
+                for (int c = 0; c < options.cols; ++c)
+                    out << (c ? "," : "") << row[c];
+                out << '\n';
+            }
+            if (!out.flush())
+                throw std::runtime_error("Cannot write " + options.output);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
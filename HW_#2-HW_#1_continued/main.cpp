@@ -1,8 +1,33 @@
 #include "SheetHandler.h"
+#include "BatchRunner.h"
+#include <string>
+#include <fstream>
+#include <iostream>
 
-int main()
+int main(int argc, char *argv[])
 {
-    SheetHandler handler;
+    // --batch <script> runs a command script without a terminal; "-" reads it from stdin.
+    if (argc > 2 && std::string(argv[1]) == "--batch")
+    {
+        std::string scriptPath = argv[2];
+        std::ifstream scriptFile;
+        if (scriptPath != "-")
+        {
+            scriptFile.open(scriptPath);
+            if (!scriptFile.is_open())
+            {
+                std::cerr << "Cannot open script " << scriptPath << std::endl;
+                return 2;
+            }
+        }
+        BatchRunner runner(std::cout);
+        return runner.run(scriptPath == "-" ? std::cin : scriptFile) == 0 ? 0 : 1;
+    }
+
+    // --prefetch loads the sheets in the background while the menu is already usable.
+    bool prefetch = argc > 1 && std::string(argv[1]) == "--prefetch";
+
+    SheetHandler handler("sheets", prefetch);
 
     handler.runMenu();
 
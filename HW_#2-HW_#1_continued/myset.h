@@ -4,18 +4,83 @@
 #include <iostream>
 #include "myvec.h"
 #include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <utility>
 
 namespace spc {
 
+/**
+ * @brief The hash myset uses; std::hash unless specialized.
+ * @tparam T The type to hash.
+ */
+template <typename T>
+struct hash {
+    size_t operator()(const T& value) const { return std::hash<T>()(value); }
+};
+
+/**
+ * @brief Hash for cell coordinates: packs both ints into 64 bits and mixes them,
+ *        so neighbouring cells spread over the whole table.
+ */
+template <>
+struct hash<std::pair<int, int>> {
+    size_t operator()(const std::pair<int, int>& cell) const {
+        uint64_t x = (static_cast<uint64_t>(static_cast<uint32_t>(cell.first)) << 32) |
+                     static_cast<uint32_t>(cell.second);
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        return static_cast<size_t>(x);
+    }
+};
+
 /**
  * @class myset
  * @brief A custom implementation of a set container that prevents duplicate elements.
+ *
+ * The elements are kept densely in insertion order, which is also the iteration
+ * order. Small sets are searched linearly; from INDEX_THRESHOLD elements on, an
+ * open-addressing table of element positions makes insert and find O(1).
  * @tparam T The type of elements stored in the set.
+ * @tparam Hash The hash function used by the index.
  */
-template <typename T>
+template <typename T, typename Hash = spc::hash<T>>
 class myset {
 private:
+    /** @brief Below this many elements a linear scan beats hashing. */
+    static constexpr size_t INDEX_THRESHOLD = 8;
+
     spc::myvec<T> elements; ///< Internal storage for elements in the set.
+    spc::myvec<uint32_t> slots; ///< Open-addressing index: position + 1 of an element, 0 if empty.
+
+    /**
+     * @brief Finds the slot holding a value, or the empty slot where it belongs.
+     */
+    size_t probe(const T& value) const {
+        size_t mask = slots.size() - 1;
+        for (size_t i = Hash()(value) & mask;; i = (i + 1) & mask) {
+            uint32_t slot = slots[i];
+            if (slot == 0 || elements[slot - 1] == value)
+                return i;
+        }
+    }
+
+    /**
+     * @brief Rebuilds the index with room for the current elements at a load factor of at most 1/2.
+     */
+    void rehash() {
+        size_t capacity = 16;
+        while (capacity < elements.size() * 2)
+            capacity *= 2;
+
+        slots.clear();
+        slots.reserve(capacity);
+        for (size_t i = 0; i < capacity; ++i)
+            slots.push_back(0);
+        for (size_t i = 0; i < elements.size(); ++i)
+            slots[probe(elements[i])] = static_cast<uint32_t>(i + 1);
+    }
 
 public:
     /**
@@ -28,9 +93,22 @@ public:
      * @param value The value to insert.
      */
     void insert(const T& value) {
-        if (std::find(elements.begin(), elements.end(), value) == elements.end()) {
+        if (slots.empty()) {
+            if (std::find(elements.begin(), elements.end(), value) != elements.end())
+                return;
             elements.push_back(value);
+            if (elements.size() >= INDEX_THRESHOLD)
+                rehash();
+            return;
         }
+
+        size_t slot = probe(value);
+        if (slots[slot] != 0)
+            return;
+        elements.push_back(value);
+        slots[slot] = static_cast<uint32_t>(elements.size());
+        if (elements.size() * 2 > slots.size())
+            rehash();
     }
 
     /**
@@ -39,7 +117,9 @@ public:
      * @return True if the value exists in the set, false otherwise.
      */
     bool find(const T& value) const {
-        return std::find(elements.begin(), elements.end(), value) != elements.end();
+        if (slots.empty())
+            return std::find(elements.begin(), elements.end(), value) != elements.end();
+        return slots[probe(value)] != 0;
     }
 
     /**
@@ -63,10 +143,12 @@ public:
      */
     void clear() {
         elements.clear();
+        slots.clear();
     }
 
     /**
      * @brief Returns an iterator to the beginning of the set.
+     *        Elements must not be modified through it, or the index goes stale.
      * @return Pointer to the first element in the set.
      */
     T* begin() { return elements.begin(); }  
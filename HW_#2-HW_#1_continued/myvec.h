@@ -3,15 +3,58 @@
 
 #include <stdexcept>
 #include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstring>
+#include <cstddef>
+#include <type_traits>
 
 #include <iostream>
 
 namespace spc
 {
 
+    template <typename T>
+    class myvec;
+
+    /**
+     * @brief Tells whether a T can be moved to another address by copying its bytes,
+     *        leaving the old bytes behind without destroying them.
+     *
+     * True for trivially copyable types; specialized below for owning handles that
+     * hold no pointer into themselves. std::string is deliberately not included:
+     * its short-string buffer lives inside the object.
+     */
+    template <typename T>
+    struct is_trivially_relocatable : std::is_trivially_copyable<T>
+    {
+    };
+
+    template <typename T>
+    struct is_trivially_relocatable<std::unique_ptr<T>> : std::true_type
+    {
+    };
+
+    template <typename T>
+    struct is_trivially_relocatable<myvec<T>> : std::true_type
+    {
+    };
+
+    template <typename A, typename B>
+    struct is_trivially_relocatable<std::pair<A, B>>
+        : std::integral_constant<bool, is_trivially_relocatable<A>::value && is_trivially_relocatable<B>::value>
+    {
+    };
+
     /**
      * @class myvec
      * @brief A custom dynamic array implementation similar to std::vector.
+     *
+     * The elements live in raw storage and are constructed in place, so unused
+     * capacity costs no constructor calls. Growth relocates trivially relocatable
+     * elements with memcpy and moves the others (copies them if their move may throw),
+     * and leaves the vector unchanged if that fails.
      * @tparam T The type of elements stored in the vector.
      */
     template <typename T>
@@ -20,15 +63,11 @@ namespace spc
     public:
         /**
          * @brief Constructor to initialize the vector with a specified capacity.
-         * @param cap The initial capacity of the vector (default is 10).
-         * @throws std::invalid_argument if the capacity is not positive.
+         * @param cap The initial capacity of the vector; nothing is allocated for 0.
          */
-        explicit myvec(int cap = 10)
-            : size(0), capacity(cap)
+        explicit myvec(size_t cap = 0)
         {
-            if (capacity <= 0)
-                throw std::invalid_argument("Capacity must be positive");
-            data = new T[capacity];
+            reserve(cap);
         }
 
         /**
@@ -36,7 +75,8 @@ namespace spc
          */
         ~myvec()
         {
-            delete[] data;
+            clear();
+            deallocate(data, capacity);
         }
 
         /**
@@ -44,13 +84,8 @@ namespace spc
          * @param other The vector to copy from.
          */
         myvec(const myvec &other)
-            : size(other.size), capacity(other.capacity)
+            : myvec(other.begin(), other.end())
         {
-            data = new T[capacity];
-            for (int i = 0; i < size; ++i)
-            {
-                data[i] = other.data[i];
-            }
         }
 
         /**
@@ -58,15 +93,16 @@ namespace spc
          * @param other The vector to move from.
          */
         myvec(myvec &&other) noexcept
-            : data(other.data), size(other.size), capacity(other.capacity)
+            : data(other.data), count(other.count), capacity(other.capacity)
         {
             other.data = nullptr;
-            other.size = 0;
+            other.count = 0;
             other.capacity = 0;
         }
 
         /**
          * @brief Copy assignment operator to copy elements from another vector.
+         *        The vector is unchanged if copying an element throws.
          * @param other The vector to copy from.
          * @return A reference to this vector.
          */
@@ -74,14 +110,8 @@ namespace spc
         {
             if (this != &other)
             {
-                delete[] data;
-                size = other.size;
-                capacity = other.capacity;
-                data = new T[capacity];
-                for (int i = 0; i < size; ++i)
-                {
-                    data[i] = other.data[i];
-                }
+                myvec copy(other);
+                swap(copy);
             }
             return *this;
         }
@@ -95,41 +125,117 @@ namespace spc
         {
             if (this != &other)
             {
-                delete[] data;
+                clear();
+                deallocate(data, capacity);
                 data = other.data;
-                size = other.size;
+                count = other.count;
                 capacity = other.capacity;
                 other.data = nullptr;
-                other.size = 0;
+                other.count = 0;
                 other.capacity = 0;
             }
             return *this;
         }
 
+        /**
+         * @brief Exchanges the contents of two vectors without touching the elements.
+         * @param other The vector to swap with.
+         */
+        void swap(myvec &other) noexcept
+        {
+            std::swap(data, other.data);
+            std::swap(count, other.count);
+            std::swap(capacity, other.capacity);
+        }
+
         /**
          * @brief Adds an element to the end of the vector (move version).
          * @param val The value to move into the vector.
          */
         void push_back(T &&val)
         {
-            if (size == capacity)
-            {
-                resize();
-            }
-            data[size++] = std::move(val);
+            emplace_back(std::move(val));
         }
 
         /**
          * @brief Adds an element to the end of the vector (copy version).
-         * @param val The value to copy into the vector.
+         * @param val The value to copy into the vector; may be an element of this vector.
          */
         void push_back(const T &val)
         {
-            if (size == capacity)
+            emplace_back(val);
+        }
+
+        /**
+         * @brief Constructs an element in place at the end of the vector.
+         * @param args The arguments passed to T's constructor; may refer to elements of this vector.
+         * @return A reference to the new element.
+         */
+        template <typename... Args>
+        T &emplace_back(Args &&...args)
+        {
+            if (count < capacity)
+            {
+                ::new (static_cast<void *>(data + count)) T(std::forward<Args>(args)...);
+            }
+            else
             {
-                resize();
+                // Construct into the new buffer before relocating, so arguments that
+                // refer to an element of this vector are still valid.
+                size_t newCapacity = grownCapacity();
+                T *newData = allocate(newCapacity);
+                try
+                {
+                    ::new (static_cast<void *>(newData + count)) T(std::forward<Args>(args)...);
+                }
+                catch (...)
+                {
+                    deallocate(newData, newCapacity);
+                    throw;
+                }
+                try
+                {
+                    relocate(data, count, newData);
+                }
+                catch (...)
+                {
+                    newData[count].~T();
+                    deallocate(newData, newCapacity);
+                    throw;
+                }
+                adopt(newData, newCapacity);
             }
-            data[size++] = val;
+            return data[count++];
+        }
+
+        /**
+         * @brief Removes the last element.
+         * @throws std::out_of_range if the vector is empty.
+         */
+        void pop_back()
+        {
+            if (count == 0)
+                throw std::out_of_range("pop_back on an empty myvec");
+            data[--count].~T();
+        }
+
+        /**
+         * @brief Ensures room for a number of elements without reallocating.
+         * @param cap The capacity to reserve; a smaller value than the current capacity is ignored.
+         */
+        void reserve(size_t cap)
+        {
+            if (cap > capacity)
+                reallocate(cap);
+        }
+
+        /**
+         * @brief Releases unused capacity; frees the storage entirely if the vector is empty.
+         */
+        void shrink_to_fit()
+        {
+            if (count < capacity)
+                reallocate(count);
         }
 
         /**
@@ -137,7 +243,7 @@ namespace spc
          * @param index The index of the element to access.
          * @return A reference to the element.
          */
-        T &operator[](int index)
+        T &operator[](size_t index)
         {
             return data[index];
         }
@@ -147,22 +253,40 @@ namespace spc
          * @param index The index of the element to access.
          * @return A const reference to the element.
          */
-        const T &operator[](int index) const
+        const T &operator[](size_t index) const
         {
             return data[index];
         }
 
+        /**
+         * @brief Access the last element.
+         * @return A reference to the last element; the vector must not be empty.
+         */
+        T &back() { return data[count - 1]; }
+
+        /**
+         * @brief Access the last element (const version).
+         * @return A const reference to the last element; the vector must not be empty.
+         */
+        const T &back() const { return data[count - 1]; }
+
         /**
          * @brief Get the current size of the vector.
          * @return The number of elements in the vector.
          */
-        int get_size() const { return size; }
+        size_t size() const { return count; }
+
+        /**
+         * @brief Get the current size of the vector as an int, for code indexing the grid with ints.
+         * @return The number of elements in the vector.
+         */
+        int get_size() const { return static_cast<int>(count); }
 
         /**
          * @brief Get the current capacity of the vector.
          * @return The maximum number of elements the vector can hold.
          */
-        int get_capacity() const { return capacity; }
+        int get_capacity() const { return static_cast<int>(capacity); }
 
         /**
          * @brief Range-based constructor to initialize the vector from iterators.
@@ -173,31 +297,42 @@ namespace spc
         template <typename InputIterator>
         myvec(InputIterator first, InputIterator last)
         {
-            size = std::distance(first, last);
-            capacity = size;
-            data = new T[capacity];
-            int index = 0;
-            for (auto it = first; it != last; ++it)
+            using Category = typename std::iterator_traits<InputIterator>::iterator_category;
+            if constexpr (std::is_base_of<std::forward_iterator_tag, Category>::value)
+                reserve(static_cast<size_t>(std::distance(first, last)));
+            try
+            {
+                for (auto it = first; it != last; ++it)
+                    emplace_back(*it);
+            }
+            catch (...)
             {
-                data[index++] = *it;
+                clear();
+                deallocate(data, capacity);
+                throw;
             }
         }
 
         /**
-         * @brief Clear all elements from the vector.
+         * @brief Clear all elements from the vector, keeping its capacity.
          */
         void clear()
         {
-            size = 0;
+            if constexpr (!std::is_trivially_destructible<T>::value)
+            {
+                for (size_t i = 0; i < count; ++i)
+                    data[i].~T();
+            }
+            count = 0;
         }
 
         /**
          * @brief Check if the vector is empty.
          * @return True if the vector is empty, false otherwise.
          */
-        bool empty()
+        bool empty() const
         {
-            return size == 0;
+            return count == 0;
         }
 
         /**
@@ -210,7 +345,7 @@ namespace spc
          * @brief Get an iterator to the end of the vector.
          * @return A pointer to one past the last element.
          */
-        T *end() { return data + size; }
+        T *end() { return data + count; }
 
         /**
          * @brief Get a const iterator to the beginning of the vector.
@@ -222,26 +357,87 @@ namespace spc
          * @brief Get a const iterator to the end of the vector.
          * @return A const pointer to one past the last element.
          */
-        const T *end() const { return data + size; }
+        const T *end() const { return data + count; }
 
     private:
-        T *data;        /**< Pointer to the array storing the elements. */
-        int size;       /**< The current number of elements in the vector. */
-        int capacity;   /**< The current capacity of the vector. */
+        T *data = nullptr;    /**< Raw storage; the first count slots hold constructed elements. */
+        size_t count = 0;     /**< The current number of elements in the vector. */
+        size_t capacity = 0;  /**< The number of slots in the storage. */
+
+        static T *allocate(size_t n)
+        {
+            return n ? std::allocator<T>().allocate(n) : nullptr;
+        }
+
+        static void deallocate(T *p, size_t n)
+        {
+            if (p)
+                std::allocator<T>().deallocate(p, n);
+        }
+
+        /**
+         * @brief The capacity to grow to when the storage is full: double, and at least 4.
+         */
+        size_t grownCapacity() const
+        {
+            return capacity < 2 ? 4 : capacity * 2;
+        }
+
+        /**
+         * @brief Moves n constructed elements from one buffer to another, uninitialized one,
+         *        and destroys the originals. If an element throws, the source is left intact.
+         */
+        static void relocate(T *from, size_t n, T *to)
+        {
+            if constexpr (is_trivially_relocatable<T>::value)
+            {
+                if (n)
+                    std::memcpy(static_cast<void *>(to), static_cast<const void *>(from), n * sizeof(T));
+                return;
+            }
+
+            size_t done = 0;
+            try
+            {
+                for (; done < n; ++done)
+                    ::new (static_cast<void *>(to + done)) T(std::move_if_noexcept(from[done]));
+            }
+            catch (...)
+            {
+                for (size_t i = 0; i < done; ++i)
+                    to[i].~T();
+                throw;
+            }
+            for (size_t i = 0; i < n; ++i)
+                from[i].~T();
+        }
 
         /**
-         * @brief Resize the vector to accommodate more elements.
+         * @brief Replaces the storage with a relocated buffer, freeing the old one.
          */
-        void resize()
+        void adopt(T *newData, size_t newCapacity)
         {
-            capacity *= 2;
-            T *new_data = new T[capacity];
-            for (int i = 0; i < size; ++i)
+            deallocate(data, capacity);
+            data = newData;
+            capacity = newCapacity;
+        }
+
+        /**
+         * @brief Moves the elements into storage of exactly the given capacity.
+         */
+        void reallocate(size_t newCapacity)
+        {
+            T *newData = allocate(newCapacity);
+            try
+            {
+                relocate(data, count, newData);
+            }
+            catch (...)
             {
-                new_data[i] = std::move(data[i]);
+                deallocate(newData, newCapacity);
+                throw;
             }
-            delete[] data;
-            data = new_data;
+            adopt(newData, newCapacity);
         }
     };
 
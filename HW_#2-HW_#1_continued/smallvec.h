@@ -0,0 +1,257 @@
+#ifndef SMALLVEC_H
+#define SMALLVEC_H
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+namespace spc
+{
+
+    /**
+     * @class smallvec
+     * @brief A vector that keeps up to N elements inside the object and only
+     *        allocates once it grows past them.
+     *
+     * Meant for short lists held by many objects, such as the precedents of a
+     * formula: most formulas read one or two ranges, so their list never touches
+     * the heap. Elements must be trivially copyable; they are moved with memcpy.
+     * @tparam T The type of elements stored in the vector.
+     * @tparam N The number of elements stored inline.
+     */
+    template <typename T, size_t N>
+    class smallvec
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "smallvec holds trivially copyable elements only");
+        static_assert(N > 0, "smallvec needs room for at least one inline element");
+
+    public:
+        /**
+         * @brief Constructs an empty vector using the inline storage.
+         */
+        smallvec() = default;
+
+        /**
+         * @brief Destructor: frees the heap storage, if any.
+         */
+        ~smallvec()
+        {
+            release();
+        }
+
+        /**
+         * @brief Copy constructor; the copy only allocates if the elements do not fit inline.
+         * @param other The vector to copy from.
+         */
+        smallvec(const smallvec &other)
+        {
+            assign(other);
+        }
+
+        /**
+         * @brief Move constructor: takes over heap storage, copies inline elements.
+         * @param other The vector to move from; left empty.
+         */
+        smallvec(smallvec &&other) noexcept
+        {
+            take(other);
+        }
+
+        /**
+         * @brief Copy assignment operator.
+         * @param other The vector to copy from.
+         * @return A reference to this vector.
+         */
+        smallvec &operator=(const smallvec &other)
+        {
+            if (this != &other)
+            {
+                count = 0;
+                assign(other);
+            }
+            return *this;
+        }
+
+        /**
+         * @brief Move assignment operator.
+         * @param other The vector to move from; left empty.
+         * @return A reference to this vector.
+         */
+        smallvec &operator=(smallvec &&other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                take(other);
+            }
+            return *this;
+        }
+
+        /**
+         * @brief Adds an element to the end of the vector.
+         * @param value The value to append; may be an element of this vector.
+         */
+        void push_back(const T &value)
+        {
+            if (count == capacity)
+            {
+                T copy = value; // value may live in the storage about to be replaced
+                grow(capacity * 2);
+                data[count++] = copy;
+                return;
+            }
+            data[count++] = value;
+        }
+
+        /**
+         * @brief Removes the last element.
+         * @throws std::out_of_range if the vector is empty.
+         */
+        void pop_back()
+        {
+            if (count == 0)
+                throw std::out_of_range("pop_back on an empty smallvec");
+            --count;
+        }
+
+        /**
+         * @brief Removes every element; heap storage is kept for reuse.
+         */
+        void clear() { count = 0; }
+
+        /**
+         * @brief Access operator to get or modify an element by index.
+         * @param index The index of the element to access.
+         * @return A reference to the element.
+         */
+        T &operator[](size_t index) { return data[index]; }
+
+        /**
+         * @brief Access operator to get an element by index (const version).
+         * @param index The index of the element to access.
+         * @return A const reference to the element.
+         */
+        const T &operator[](size_t index) const { return data[index]; }
+
+        /**
+         * @brief Access the last element.
+         * @return A reference to the last element; the vector must not be empty.
+         */
+        T &back() { return data[count - 1]; }
+
+        /**
+         * @brief Access the last element (const version).
+         * @return A const reference to the last element; the vector must not be empty.
+         */
+        const T &back() const { return data[count - 1]; }
+
+        /**
+         * @brief Get the current size of the vector.
+         * @return The number of elements in the vector.
+         */
+        size_t size() const { return count; }
+
+        /**
+         * @brief Check if the vector is empty.
+         * @return True if the vector is empty, false otherwise.
+         */
+        bool empty() const { return count == 0; }
+
+        /**
+         * @brief Tells how many bytes the vector has allocated outside itself.
+         * @return 0 while the elements fit inline.
+         */
+        size_t heapUsage() const { return isInline() ? 0 : capacity * sizeof(T); }
+
+        /**
+         * @brief Get an iterator to the beginning of the vector.
+         * @return A pointer to the first element.
+         */
+        T *begin() { return data; }
+
+        /**
+         * @brief Get an iterator to the end of the vector.
+         * @return A pointer to one past the last element.
+         */
+        T *end() { return data + count; }
+
+        /**
+         * @brief Get a const iterator to the beginning of the vector.
+         * @return A const pointer to the first element.
+         */
+        const T *begin() const { return data; }
+
+        /**
+         * @brief Get a const iterator to the end of the vector.
+         * @return A const pointer to one past the last element.
+         */
+        const T *end() const { return data + count; }
+
+    private:
+        alignas(T) unsigned char inlineStorage[N * sizeof(T)]; ///< Room for the first N elements.
+        T *data = reinterpret_cast<T *>(inlineStorage);         ///< The inline storage or a heap block.
+        size_t count = 0;                                       ///< The current number of elements.
+        size_t capacity = N;                                    ///< The number of elements data can hold.
+
+        bool isInline() const { return data == reinterpret_cast<const T *>(inlineStorage); }
+
+        /**
+         * @brief Moves the elements into a heap block of the given capacity.
+         */
+        void grow(size_t newCapacity)
+        {
+            T *block = std::allocator<T>().allocate(newCapacity);
+            std::memcpy(static_cast<void *>(block), static_cast<const void *>(data), count * sizeof(T));
+            release();
+            data = block;
+            capacity = newCapacity;
+        }
+
+        /**
+         * @brief Frees the heap block, if any, and returns to the inline storage.
+         */
+        void release()
+        {
+            if (!isInline())
+                std::allocator<T>().deallocate(data, capacity);
+            data = reinterpret_cast<T *>(inlineStorage);
+            capacity = N;
+        }
+
+        /**
+         * @brief Copies the elements of another vector into this empty one.
+         */
+        void assign(const smallvec &other)
+        {
+            if (other.count > capacity)
+                grow(other.count);
+            std::memcpy(static_cast<void *>(data), static_cast<const void *>(other.data), other.count * sizeof(T));
+            count = other.count;
+        }
+
+        /**
+         * @brief Takes the elements of another vector; this one must own no heap block.
+         */
+        void take(smallvec &other) noexcept
+        {
+            if (other.isInline())
+            {
+                std::memcpy(static_cast<void *>(data), static_cast<const void *>(other.data), other.count * sizeof(T));
+            }
+            else
+            {
+                data = other.data;
+                capacity = other.capacity;
+                other.data = reinterpret_cast<T *>(other.inlineStorage);
+                other.capacity = N;
+            }
+            count = other.count;
+            other.count = 0;
+        }
+    };
+
+} // namespace spc
+
+#endif // SMALLVEC_H